@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,7 +14,6 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <sched.h>
 #include <string.h>
 #include <getopt.h>
 #include <stdbool.h>
@@ -21,108 +21,698 @@
 #include <linux/fs.h>
 
 #include "dev.h"
+#include "rand.h"
+#include "timing.h"
+#include "trace.h"
 
-#define MAX_BUFSIZE (64 * 1024 * 1024)
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
 
-static inline long long time_to_ns(struct timespec *ts)
+/*
+ * Writes of random data are spread over at least this much memory
+ * before any data gets written twice.
+ */
+#define RAND_RING_MIN (8 * 1024 * 1024)
+
+/*
+ * Large buffers come from explicit hugepages if the system has any
+ * reserved, or are at least aligned so they can use transparent
+ * hugepages. Either way, O_DIRECT transfers need fewer TLB entries
+ * and IOMMU mappings.
+ */
+static void *alloc_buffer(size_t *size)
 {
-	return (long long)ts->tv_sec * 1000 * 1000 * 1000 + ts->tv_nsec;
+	size_t len = *size;
+	char *p, *aligned;
+
+	if (len < HUGEPAGE_SIZE)
+		len = (len + 4095) & ~(size_t)4095;
+	else
+		len = (len + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+	*size = len;
+
+	if (len >= HUGEPAGE_SIZE) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			return p;
+	}
+
+	p = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* trim to a hugepage aligned range */
+	aligned = (char *)(((unsigned long)p + HUGEPAGE_SIZE - 1) &
+			   ~(unsigned long)(HUGEPAGE_SIZE - 1));
+	if (aligned > p)
+		munmap(p, aligned - p);
+	munmap(aligned + len, p + HUGEPAGE_SIZE - aligned);
+
+	if (len >= HUGEPAGE_SIZE)
+		madvise(aligned, len, MADV_HUGEPAGE);
+
+	return aligned;
 }
 
-static long long get_ns(void)
+static int grow_buffer(struct device *dev, void **buf, size_t *cur,
+		       size_t size, int pattern)
 {
-	struct timespec ts;
-	clock_gettime(CLOCK_REALTIME, &ts);
-	return time_to_ns(&ts);
+	void *p;
+
+	if (size < dev->bufsize_hint)
+		size = dev->bufsize_hint;
+
+	p = alloc_buffer(&size);
+	if (!p)
+		return -ENOMEM;
+
+	/* also faults in every page, so this never happens while timing */
+	memset(p, pattern, size);
+
+	if (*buf)
+		munmap(*buf, *cur);
+	*buf = p;
+	*cur = size;
+
+	return 0;
 }
 
-long long time_read(struct device *dev, off_t pos, size_t size)
+/*
+ * Make sure the buffer for an I/O of the given size exists. This
+ * is cheap when nothing needs to be done, but should still be
+ * called before starting the clock.
+ */
+int prepare_buffer(struct device *dev, enum io_dir dir,
+		   enum writebuf which, size_t size)
 {
-	long long now = get_ns();
-	ssize_t ret;
+	static const int pattern[] = {
+		[WBUF_ZERO] = 0,
+		[WBUF_ONE] = 0xff,
+		[WBUF_RAND] = 0x5a,
+	};
+	int err;
 
 	if (size > MAX_BUFSIZE)
 		return -ENOMEM;
 
-	do {
-		ret = pread(dev->fd, dev->readbuf, size, pos % dev->size);
+	if (dir == IO_READ) {
+		if (size <= dev->readbuf_size)
+			return 0;
+		return grow_buffer(dev, &dev->readbuf, &dev->readbuf_size,
+				   size, 0);
+	}
+
+	/*
+	 * a slot of the largest request for each one in flight, see
+	 * queue_async, and at queue depth one another for time_write
+	 */
+	if (dir == IO_WRITE && which == WBUF_RAND) {
+		if (size < dev->bufsize_hint)
+			size = dev->bufsize_hint;
+		size = (dev->qd + 1) * ((size + 4095) & ~(size_t)4095);
+		if (size < RAND_RING_MIN)
+			size = RAND_RING_MIN;
+		if (size <= dev->writebuf_size[which])
+			return 0;
+		err = grow_buffer(dev, &dev->writebuf[which],
+				  &dev->writebuf_size[which], size,
+				  pattern[which]);
+		if (err)
+			return err;
+		rng_fill(dev->rng, dev->writebuf[which],
+			 dev->writebuf_size[which], dev->compress);
+		dev->rand_pos = 0;
+		return 0;
+	}
+
+	if (dir == IO_WRITE) {
+		if (size <= dev->writebuf_size[which])
+			return 0;
+		return grow_buffer(dev, &dev->writebuf[which],
+				   &dev->writebuf_size[which], size,
+				   pattern[which]);
+	}
+
+	return 0;
+}
+
+/*
+ * Return the buffer to write from. For random data, this is the next
+ * unused part of the ring, which must be passed to refill_buffer
+ * after the write.
+ */
+static void *write_buffer(struct device *dev, enum writebuf which, size_t size)
+{
+	void *p;
+
+	if (which != WBUF_RAND)
+		return dev->writebuf[which];
+
+	size = (size + 4095) & ~(size_t)4095;
+	if (dev->rand_pos + size > dev->writebuf_size[WBUF_RAND])
+		dev->rand_pos = 0;
+
+	p = (char *)dev->writebuf[WBUF_RAND] + dev->rand_pos;
+	dev->rand_pos += size;
+
+	return p;
+}
+
+/* replace random data that has been written, outside of the timing */
+static void refill_buffer(struct device *dev, enum writebuf which,
+			  void *p, size_t size)
+{
+	if (which == WBUF_RAND)
+		rng_fill(dev->rng, p, size, dev->compress);
+}
+
+/*
+ * Tell the device about the largest I/O the selected tests will do,
+ * so each buffer is allocated only once.
+ */
+void reserve_buffers(struct device *dev, size_t size)
+{
+	if (size > MAX_BUFSIZE)
+		size = MAX_BUFSIZE;
+
+	if (size > dev->bufsize_hint)
+		dev->bufsize_hint = size;
+}
+
+/*
+ * Allocate all buffers at their full size now instead of on first
+ * use, so no test runs into the page faults for them.
+ */
+int prefault_buffers(struct device *dev)
+{
+	int err, which;
+
+	err = prepare_buffer(dev, IO_READ, 0, dev->bufsize_hint);
+	for (which = WBUF_ZERO; which <= WBUF_RAND && !err; which++)
+		err = prepare_buffer(dev, IO_WRITE, which, dev->bufsize_hint);
+
+	return err;
+}
+
+static inline long long dev_now(struct device *dev)
+{
+	return dev->ops->now ? dev->ops->now(dev) : get_ns();
+}
+
+/*
+ * time from start to now, minus the fixed cost of measuring it,
+ * which a simulated clock does not have, but never below 1 ns, so
+ * a fast I/O on a noisy clock cannot look like it took no time
+ */
+static inline long long span_ns(struct device *dev, long long start,
+				long long now)
+{
+	long long ns;
+
+	if (dev->ops->now)
+		return now - start;
+
+	ns = now - start - timing_overhead;
+	return ns > 0 ? ns : 1;
+}
+
+static inline long long elapsed_ns(struct device *dev, long long start)
+{
+	return span_ns(dev, start, dev_now(dev));
+}
+
+static inline void account(struct device *dev, enum io_dir dir, size_t size)
+{
+	dev->nr_io[dir]++;
+	dev->io_bytes[dir] += size;
+}
+
+/* pos as the device saw it, after wrapping around like the engines do */
+static inline void trace(struct device *dev, enum io_dir dir, off_t pos,
+			 size_t size, long long start, long long ns)
+{
+	if (dev->trace_id >= 0)
+		trace_add(dev->trace_id, dir, pos % dev->size, size,
+			  start - dev->trace_base, ns);
+}
+
+long long time_read(struct device *dev, off_t pos, size_t size)
+{
+	long long start, now;
+	ssize_t ret = 0;
+	size_t total = size;
+	off_t first = pos % dev->size;
+
+	if (prepare_buffer(dev, IO_READ, 0, size))
+		return -ENOMEM;
+
+	start = dev_now(dev);
+	while (size) {
+		ret = dev->ops->read(dev, dev->readbuf, size, pos % dev->size);
 		if (ret > 0) {
 			size -= ret;
 			pos += ret;
+		} else if (ret == 0 || (errno != EAGAIN && errno != EINTR)) {
+			break;
 		}
-	} while (ret > 0 || errno == -EAGAIN);
+	}
+	now = elapsed_ns(dev, start);
 
-	if (ret) {
+	if (ret < 0) {
 		perror("time_read");
 		return 0;
 	}
 
-	return get_ns() - now;
+	account(dev, IO_READ, total - size);
+	trace(dev, IO_READ, first, total - size, start, now);
+	return now;
 }
 
 long long time_write(struct device *dev, off_t pos, size_t size, enum writebuf which)
 {
-	long long now = get_ns();
-	ssize_t ret;
-	unsigned long *p;
+	long long start, now;
+	ssize_t ret = 0;
+	size_t done = 0;
+	off_t first = pos % dev->size;
+	char *p;
 
-	if (size > MAX_BUFSIZE)
+	if (prepare_buffer(dev, IO_WRITE, which, size))
 		return -ENOMEM;
-	p = dev->writebuf[which];
+	p = write_buffer(dev, which, size);
 
-	do {
-		ret = pwrite(dev->fd, p, size, pos % dev->size);
+	start = dev_now(dev);
+	while (done < size) {
+		ret = dev->ops->write(dev, p + done, size - done, pos % dev->size);
 		if (ret > 0) {
-			size -= ret;
+			done += ret;
 			pos += ret;
+		} else if (ret == 0 || (errno != EAGAIN && errno != EINTR)) {
+			break;
 		}
-	} while (ret > 0 || errno == -EAGAIN);
+	}
+	now = elapsed_ns(dev, start);
 
-	if (ret) {
+	refill_buffer(dev, which, p, size);
+
+	if (ret < 0) {
 		perror("time_write");
 		return 0;
 	}
 
-	return get_ns() - now;
+	account(dev, IO_WRITE, done);
+	trace(dev, IO_WRITE, first, done, start, now);
+	return now;
 }
 
 long long time_erase(struct device *dev, off_t pos, size_t size)
 {
-	long long now = get_ns();
-	ssize_t ret;
-	unsigned long long args[2] = { size, pos % dev->size };
+	long long start, now;
+	int ret;
 
 	if (size > MAX_BUFSIZE)
 		return -ENOMEM;
 
-	ret = ioctl(dev->fd, BLKDISCARD, &args);
+	start = dev_now(dev);
+	ret = dev->ops->discard(dev, pos % dev->size, size);
+	now = elapsed_ns(dev, start);
 
+	/* failing like time_read and time_write, with no time at all */
 	if (ret) {
 		perror("time_erase");
+		return 0;
 	}
 
-	return get_ns() - now;
+	account(dev, IO_ERASE, size);
+	trace(dev, IO_ERASE, pos % dev->size, size, start, now);
+	return now;
 }
 
-static void set_rtprio(void)
+long long time_flush(struct device *dev)
 {
+	long long now;
 	int ret;
-	struct sched_param p = {
-		.sched_priority = 10,
-	};
-	ret = sched_setscheduler(0, SCHED_FIFO, &p);
-	if (ret)
-		perror("sched_setscheduler");
+
+	now = dev_now(dev);
+	ret = dev->ops->flush(dev);
+	now = elapsed_ns(dev, now);
+
+	if (ret) {
+		perror("time_flush");
+	}
+
+	return now;
+}
+
+/*
+ * Sleep until shortly before the given time and spin for the rest.
+ * A simulated clock only moves with the I/O, so there is no waiting
+ * for it, and every request is due right away.
+ */
+static void wait_until(struct device *dev, long long t)
+{
+	struct timespec ts;
+	long long left;
+
+	if (dev->ops->now)
+		return;
+
+	while ((left = t - get_ns()) > 0) {
+		if (left > 200000) {
+			left -= 100000;
+			ts.tv_sec = left / 1000000000;
+			ts.tv_nsec = left % 1000000000;
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+static inline bool due(struct device *dev, struct io_request *req,
+		       long long start)
+{
+	return req->at <= 0 || dev->ops->now ||
+	       req->at <= dev_now(dev) - start;
 }
 
+/*
+ * Run all requests through the engine, keeping up to dev->qd of them
+ * in flight at any time. Each request gets its own latency from the
+ * moment it was handed to the engine until its completion was seen.
+ * Requests with a time to submit at, counted from start, are held
+ * back until then; while others are in flight, waiting for those ends
+ * in time to submit the next one, with the same margin as wait_until.
+ * After the first failure, nothing more gets submitted, but the
+ * requests in flight are still waited for, as the engine refers to
+ * them until they complete.
+ *
+ * For random write data, the ring is split into one slot per request
+ * in flight, which prepare_buffer made large enough for any request.
+ * A request takes a free slot when it is submitted, and gives it back
+ * refilled when it completes, in whatever order that happens, so no
+ * two requests write the same data, however many are in the batch.
+ */
+static int queue_async(struct device *dev, struct io_request *req,
+		       unsigned int count, long long start)
+{
+	unsigned int next = 0, done = 0, inflight = 0, first, i;
+	struct io_request *finished[dev->qd];
+	unsigned int slots[dev->qd], nr_slots;
+	char *ring = dev->writebuf[WBUF_RAND];
+	size_t slot_size;
+	long long now, wait;
+	int ret, err = 0;
+
+	slot_size = (dev->writebuf_size[WBUF_RAND] / dev->qd) & ~(size_t)4095;
+	for (nr_slots = 0; nr_slots < dev->qd; nr_slots++)
+		slots[nr_slots] = nr_slots;
+
+	while (done < count) {
+		first = next;
+		while (!err && inflight < dev->qd && next < count &&
+		       due(dev, &req[next], start)) {
+			next++;
+			inflight++;
+		}
+
+		if (next > first) {
+			for (i = first; i < next; i++) {
+				if (req[i].dir == IO_READ)
+					req[i].buf = dev->readbuf;
+				else if (req[i].which == WBUF_RAND)
+					req[i].buf = ring + slots[--nr_slots] * slot_size;
+				else
+					req[i].buf = dev->writebuf[req[i].which];
+			}
+
+			now = dev_now(dev);
+			for (i = first; i < next; i++) {
+				req[i].start = now;
+				if (req[i].at)
+					req[i].late = now - start - req[i].at;
+			}
+			ret = dev->ops->submit(dev, &req[first], next - first);
+			if (ret < 0) {
+				err = ret;
+				for (i = first; i < next; i++)
+					if (req[i].dir == IO_WRITE &&
+					    req[i].which == WBUF_RAND)
+						slots[nr_slots++] = ((char *)req[i].buf - ring) /
+								    slot_size;
+				inflight -= next - first;
+				next = first;
+			}
+		}
+
+		if (!inflight) {
+			if (err)
+				break;
+			wait_until(dev, start + req[next].at);
+			continue;
+		}
+
+		/* only stopped early for a request that is not due yet */
+		wait = -1;
+		if (!err && inflight < dev->qd && next < count) {
+			wait = start + req[next].at - dev_now(dev);
+			wait = wait > 200000 ? wait - 100000 : 0;
+		}
+
+		ret = dev->ops->complete(dev, finished, inflight, wait);
+		if (ret < 0)
+			return ret;
+
+		now = dev_now(dev);
+		for (i = 0; i < (unsigned int)ret; i++) {
+			finished[i]->ns = span_ns(dev, finished[i]->start, now);
+			if (finished[i]->err && !err)
+				err = finished[i]->err;
+		}
+		for (i = 0; i < (unsigned int)ret; i++) {
+			if (finished[i]->dir != IO_WRITE ||
+			    finished[i]->which != WBUF_RAND)
+				continue;
+			refill_buffer(dev, WBUF_RAND, finished[i]->buf,
+				      finished[i]->size);
+			slots[nr_slots++] = ((char *)finished[i]->buf - ring) /
+					    slot_size;
+		}
+		inflight -= ret;
+		done += ret;
+	}
+
+	return err;
+}
+
+/*
+ * Time a batch of requests. With a queue depth of one, this is the
+ * same as calling time_read/time_write for each request in turn,
+ * otherwise, or after setup_async, the requests are handed to the
+ * engine so that up to dev->qd of them are in flight at once. The
+ * engine cannot erase, so there each erase waits for the requests
+ * before it and is done on its own, before any of those after it.
+ */
+long long time_queue(struct device *dev, struct io_request *req, unsigned int count)
+{
+	bool async = dev->qd > 1 || dev->async;
+	unsigned int i, j;
+	long long now;
+	int ret;
+
+	for (i = 0; i < count; i++)
+		if (prepare_buffer(dev, req[i].dir, req[i].which, req[i].size))
+			return -ENOMEM;
+
+	now = dev_now(dev);
+	for (i = 0; i < count; i = j) {
+		j = i + 1;
+		if (async && req[i].dir != IO_ERASE) {
+			while (j < count && req[j].dir != IO_ERASE)
+				j++;
+
+			ret = queue_async(dev, &req[i], j - i, now);
+			if (ret < 0)
+				return ret;
+
+			for (; i < j; i++) {
+				account(dev, req[i].dir, req[i].size);
+				trace(dev, req[i].dir, req[i].pos, req[i].size,
+				      req[i].start, req[i].ns);
+			}
+			continue;
+		}
+
+		if (req[i].at) {
+			wait_until(dev, now + req[i].at);
+			req[i].late = dev_now(dev) - now - req[i].at;
+		}
+
+		if (req[i].dir == IO_READ)
+			req[i].ns = time_read(dev, req[i].pos, req[i].size);
+		else if (req[i].dir == IO_ERASE)
+			req[i].ns = time_erase(dev, req[i].pos, req[i].size);
+		else
+			req[i].ns = time_write(dev, req[i].pos, req[i].size,
+					       req[i].which);
+		if (req[i].ns < 0)
+			return req[i].ns;
 
-int setup_dev(struct device *dev, const char *filename)
+		/* a failed request has already been reported, but no time */
+		req[i].err = req[i].ns ? 0 : -EIO;
+	}
+
+	return async ? elapsed_ns(dev, now) : dev_now(dev) - now;
+}
+
+int setup_qd(struct device *dev, unsigned int qd)
 {
 	int err;
-	void *p;
-	set_rtprio();
 
-	dev->fd = open(filename, O_RDWR | O_DIRECT | O_SYNC | O_NOATIME);
+	dev->async = 0;
+	if (qd <= 1) {
+		dev->qd = 1;
+		return 0;
+	}
+
+	if (!dev->ops->setup_qd)
+		return -EOPNOTSUPP;
+
+	err = dev->ops->setup_qd(dev, qd);
+	if (err)
+		return err;
+
+	dev->qd = qd;
+	return 0;
+}
+
+/*
+ * Like setup_qd, but also at queue depth one through the engine's
+ * submit and complete, so that all depths are measured the same way.
+ */
+int setup_async(struct device *dev, unsigned int qd)
+{
+	int err;
+
+	if (!dev->ops->setup_qd)
+		return -EOPNOTSUPP;
+
+	err = dev->ops->setup_qd(dev, qd);
+	if (err)
+		return err;
+
+	dev->qd = qd;
+	dev->async = 1;
+	return 0;
+}
+
+ssize_t sync_read(struct device *dev, void *buf, size_t size, off_t pos)
+{
+	return pread(dev->fd, buf, size, pos);
+}
+
+ssize_t sync_write(struct device *dev, const void *buf, size_t size, off_t pos)
+{
+	return pwrite(dev->fd, buf, size, pos);
+}
+
+int sync_discard(struct device *dev, off_t pos, size_t size)
+{
+	unsigned long long args[2] = { size, pos };
+
+	return ioctl(dev->fd, BLKDISCARD, &args);
+}
+
+int sync_flush(struct device *dev)
+{
+	return fsync(dev->fd);
+}
+
+const struct dev_ops sync_ops = {
+	.name = "sync",
+	.read = sync_read,
+	.write = sync_write,
+	.discard = sync_discard,
+	.flush = sync_flush,
+};
+
+/* the first one is the default */
+static const struct dev_ops *engines[] = {
+	&uring_ops,
+	&sync_ops,
+	&sim_ops,
+};
+
+const char *dev_engines(void)
+{
+	static char names[64];
+	unsigned int i;
+	size_t pos = 0;
+
+	if (names[0])
+		return names;
+
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+		pos += snprintf(names + pos, sizeof(names) - pos, "%s%s",
+				i ? "|" : "", engines[i]->name);
+
+	return names;
+}
+
+/* look up "name" or "name:options" */
+static const struct dev_ops *find_engine(const char *name, const char **options)
+{
+	unsigned int i;
+	size_t len;
+
+	*options = NULL;
+	if (!name)
+		return engines[0];
+
+	len = strcspn(name, ":");
+	if (name[len] == ':')
+		*options = name + len + 1;
+
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+		if (strlen(engines[i]->name) == len &&
+		    !strncmp(engines[i]->name, name, len))
+			return engines[i];
+
+	return NULL;
+}
+
+int setup_compress(struct device *dev, unsigned int compress)
+{
+	if (compress > 100)
+		return -EINVAL;
+
+	dev->compress = compress;
+
+	/* start over with data of the new kind */
+	if (dev->writebuf[WBUF_RAND])
+		rng_fill(dev->rng, dev->writebuf[WBUF_RAND],
+			 dev->writebuf_size[WBUF_RAND], compress);
+
+	return 0;
+}
+
+int setup_dev(struct device *dev, const char *filename, const char *engine)
+{
+	const char *options;
+	int err, i, flags;
+
+	dev->ops = find_engine(engine, &options);
+	if (!dev->ops) {
+		fprintf(stderr, "unknown engine '%s', use %s\n", engine,
+			dev_engines());
+		return -EINVAL;
+	}
+	dev->priv = NULL;
+	dev->qd = 1;
+
+	flags = dev->ops->open_flags;
+	if (!flags)
+		flags = O_RDWR | O_DIRECT | O_SYNC | O_NOATIME;
+
+	dev->fd = open(filename, flags);
 	if (dev->fd < 0) {
 		perror(filename);
 		return -errno;
@@ -134,27 +724,38 @@ int setup_dev(struct device *dev, const char *filename)
 		return -errno;
 	}
 
-	err = posix_memalign(&dev->readbuf,		4096, MAX_BUFSIZE);
-	if (err)
-		return -err;
+	if (dev->ops->setup) {
+		err = dev->ops->setup(dev, options);
+		if (err)
+			return err;
+	} else if (options) {
+		fprintf(stderr, "engine %s takes no options\n", dev->ops->name);
+		return -EINVAL;
+	}
 
-	err = posix_memalign(&p, 4096, MAX_BUFSIZE);
-	if (err)
-		return -err;
-	memset(p, 0, MAX_BUFSIZE);
-	dev->writebuf[WBUF_ZERO] = p;
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	for (i = 0; i < 3; i++) {
+		dev->writebuf[i] = NULL;
+		dev->writebuf_size[i] = 0;
+	}
+	dev->bufsize_hint = 0;
 
-	err = posix_memalign(&p,  4096, MAX_BUFSIZE);
-	if (err)
-		return -err;
-	memset(p, 0xff, MAX_BUFSIZE);
-	dev->writebuf[WBUF_ONE] = p;
+	dev->rng = rng_new(0x666c617368ull);
+	if (!dev->rng)
+		return -ENOMEM;
+	dev->rand_pos = 0;
+	dev->compress = 0;
+	memset(dev->nr_io, 0, sizeof(dev->nr_io));
+	memset(dev->io_bytes, 0, sizeof(dev->io_bytes));
+	dev->trace_id = trace_attach();
+	dev->trace_base = dev_now(dev);
 
-	err = posix_memalign(&p , 4096, MAX_BUFSIZE);
+	err = prepare_buffer(dev, IO_READ, 0, 4096);
 	if (err)
-		return -err;
-	memset(p, 0x5a, MAX_BUFSIZE);
-	dev->writebuf[WBUF_RAND] = p;
+		return err;
+
+	timing_setup(dev->fd, dev->readbuf);
 
 	return 0;
 }
@@ -3,11 +3,84 @@
 
 #include <unistd.h>
 
+#define MAX_BUFSIZE (64 * 1024 * 1024)
+
+struct rng;
+struct device;
+struct io_request;
+
+/*
+ * I/O engine behind the time_* functions. read, write, discard and
+ * flush are required and behave like the system calls, returning -1
+ * and setting errno on failure. Engines that can keep more than one
+ * request in flight also provide setup_qd, submit and complete:
+ * submit queues all of the requests or none, but may not start them
+ * before the next complete, which waits up to wait ns, or without a
+ * limit if that is negative, for at least one request to finish, and
+ * stores up to max finished ones in done, with err set for those
+ * that failed. Simulated devices bring their own
+ * clock in now. setup gets the options following the engine name and
+ * a colon, after the device has been opened with open_flags, or the
+ * usual flags for direct I/O if that is zero.
+ */
+struct dev_ops {
+	const char *name;
+	int open_flags;
+	int (*setup)(struct device *dev, const char *options);
+
+	ssize_t (*read)(struct device *dev, void *buf, size_t size, off_t pos);
+	ssize_t (*write)(struct device *dev, const void *buf, size_t size,
+			 off_t pos);
+	int (*discard)(struct device *dev, off_t pos, size_t size);
+	int (*flush)(struct device *dev);
+
+	int (*setup_qd)(struct device *dev, unsigned int qd);
+	int (*submit)(struct device *dev, struct io_request *req,
+		      unsigned int count);
+	int (*complete)(struct device *dev, struct io_request **done,
+			unsigned int max, long long wait);
+
+	long long (*now)(struct device *dev);
+};
+
 struct device {
+	const struct dev_ops *ops;
+	void *priv;		/* owned by the engine */
+
 	void *readbuf;
 	void *writebuf[3];
 	int fd;
 	off_t size;
+
+	/* buffers are allocated on first use, at least bufsize_hint bytes */
+	size_t readbuf_size;
+	size_t writebuf_size[3];
+	size_t bufsize_hint;
+
+	/*
+	 * number of requests kept in flight by time_queue, which goes
+	 * through the engine's submit and complete above one, or always
+	 * after setup_async
+	 */
+	unsigned int qd;
+	int async;
+
+	/*
+	 * WBUF_RAND is a ring of random data, each write takes the next
+	 * part of it and that part is refilled once the write is done.
+	 * compress is the percentage of each 4 KiB block that is zero.
+	 */
+	struct rng *rng;
+	size_t rand_pos;
+	unsigned int compress;
+
+	/* requests and bytes done so far, by enum io_dir */
+	unsigned long long nr_io[3];
+	unsigned long long io_bytes[3];
+
+	/* number in the trace, or -1, and the clock when it was attached */
+	int trace_id;
+	long long trace_base;
 };
 
 enum writebuf {
@@ -16,7 +89,54 @@ enum writebuf {
 	WBUF_RAND,
 };
 
-extern int setup_dev(struct device *dev, const char *filename);
+enum io_dir {
+	IO_READ,
+	IO_WRITE,
+	IO_ERASE,
+};
+
+/* one entry in a batch of I/O passed to time_queue */
+struct io_request {
+	off_t pos;
+	size_t size;
+	enum io_dir dir;
+	enum writebuf which;
+
+	/* data to transfer, filled in by time_queue */
+	void *buf;
+
+	/*
+	 * earliest submission in ns after time_queue started, for
+	 * replaying a trace with its timing, or zero for right away
+	 */
+	long long at;
+
+	/* latency from submission to completion, filled in by time_queue */
+	long long ns;
+	long long start;
+
+	/* negative errno if it failed, filled in by time_queue */
+	int err;
+
+	/* with a time to submit at, how much later than that it was */
+	long long late;
+};
+
+extern int setup_dev(struct device *dev, const char *filename,
+		     const char *engine);
+
+extern int setup_qd(struct device *dev, unsigned int qd);
+
+extern int setup_async(struct device *dev, unsigned int qd);
+
+extern int setup_compress(struct device *dev, unsigned int compress);
+
+extern void reserve_buffers(struct device *dev, size_t size);
+
+extern int prefault_buffers(struct device *dev);
+
+extern int prepare_buffer(struct device *dev, enum io_dir dir,
+			  enum writebuf which, size_t size);
 
 long long time_write(struct device *dev, off_t pos, size_t size, enum writebuf which);
 
@@ -24,4 +144,22 @@ long long time_read(struct device *dev, off_t pos, size_t size);
 
 long long time_erase(struct device *dev, off_t pos, size_t size);
 
+long long time_flush(struct device *dev);
+
+long long time_queue(struct device *dev, struct io_request *req, unsigned int count);
+
+/* names of all engines, separated by '|' */
+extern const char *dev_engines(void);
+
+/* the plain system calls, for use by other engines */
+extern ssize_t sync_read(struct device *dev, void *buf, size_t size, off_t pos);
+extern ssize_t sync_write(struct device *dev, const void *buf, size_t size,
+			  off_t pos);
+extern int sync_discard(struct device *dev, off_t pos, size_t size);
+extern int sync_flush(struct device *dev);
+
+extern const struct dev_ops sync_ops;
+extern const struct dev_ops uring_ops;
+extern const struct dev_ops sim_ops;
+
 #endif /* FLASHBENCH_DEV_H */
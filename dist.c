@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "dist.h"
+
+static unsigned long long splitmix64(unsigned long long *x)
+{
+	unsigned long long z = (*x += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+double dist_uniform(struct dist *d)
+{
+	return (splitmix64(&d->state) >> 11) * (1.0 / (1ull << 53));
+}
+
+/* uniform in 0 .. n-1 */
+static unsigned long long uniform_below(struct dist *d, unsigned long long n)
+{
+	unsigned long long v = dist_uniform(d) * n;
+
+	return v < n ? v : n - 1;
+}
+
+int dist_parse(struct dist *d, const char *spec)
+{
+	char *end;
+
+	memset(d, 0, sizeof(*d));
+
+	if (!strcmp(spec, "uniform")) {
+		d->type = DIST_UNIFORM;
+	} else if (!strcmp(spec, "seq")) {
+		d->type = DIST_SEQ;
+	} else if (!strncmp(spec, "zipf", 4)) {
+		d->type = DIST_ZIPF;
+		d->theta = 0.99;
+		if (spec[4] == ':') {
+			d->theta = strtod(spec + 5, &end);
+			if (*end || d->theta <= 0)
+				return -EINVAL;
+		} else if (spec[4]) {
+			return -EINVAL;
+		}
+	} else if (!strncmp(spec, "hotcold", 7)) {
+		d->type = DIST_HOTCOLD;
+		d->hot = 20;
+		d->share = 80;
+		if (spec[7] == ':') {
+			d->hot = strtoul(spec + 8, &end, 10);
+			if (*end != ':')
+				return -EINVAL;
+			d->share = strtoul(end + 1, &end, 10);
+			if (*end || !d->hot || d->hot >= 100 || d->share > 100)
+				return -EINVAL;
+		} else if (spec[7]) {
+			return -EINVAL;
+		}
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Vose's alias method: every entry starts out with its probability
+ * times the number of entries. Entries below one are filled up with
+ * the excess of one above one, which becomes their alias, until all
+ * of them are exactly one.
+ */
+static int alias_init(struct dist *d, double *p)
+{
+	unsigned int *small, *large;
+	unsigned long long i, nr_small = 0, nr_large = 0;
+	unsigned int l, g;
+
+	small = malloc(d->ranks * sizeof(*small));
+	large = malloc(d->ranks * sizeof(*large));
+	if (!small || !large) {
+		free(small);
+		free(large);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < d->ranks; i++) {
+		if (p[i] < 1.0)
+			small[nr_small++] = i;
+		else
+			large[nr_large++] = i;
+	}
+
+	while (nr_small && nr_large) {
+		l = small[--nr_small];
+		g = large[--nr_large];
+
+		d->prob[l] = p[l];
+		d->alias[l] = g;
+
+		p[g] += p[l] - 1.0;
+		if (p[g] < 1.0)
+			small[nr_small++] = g;
+		else
+			large[nr_large++] = g;
+	}
+
+	/* only rounding errors are left */
+	while (nr_large)
+		d->prob[large[--nr_large]] = 1.0;
+	while (nr_small)
+		d->prob[small[--nr_small]] = 1.0;
+
+	free(small);
+	free(large);
+	return 0;
+}
+
+static int zipf_init(struct dist *d)
+{
+	unsigned long long i;
+	double sum = 0;
+	int ret;
+
+	d->ranks = d->n < DIST_MAX_RANKS ? d->n : DIST_MAX_RANKS;
+	d->group = (d->n + d->ranks - 1) / d->ranks;
+	d->ranks = (d->n + d->group - 1) / d->group;
+
+	d->prob = malloc(d->ranks * sizeof(*d->prob));
+	d->alias = malloc(d->ranks * sizeof(*d->alias));
+	if (!d->prob || !d->alias) {
+		dist_free(d);
+		return -ENOMEM;
+	}
+
+	/* the weights go into prob first and are scaled in place */
+	for (i = 0; i < d->ranks; i++) {
+		d->prob[i] = 1.0 / pow(i + 1, d->theta);
+		sum += d->prob[i];
+	}
+	for (i = 0; i < d->ranks; i++)
+		d->prob[i] *= d->ranks / sum;
+
+	ret = alias_init(d, d->prob);
+	if (ret)
+		dist_free(d);
+
+	return ret;
+}
+
+int dist_init(struct dist *d, unsigned long long n, unsigned long long seed)
+{
+	if (!n)
+		return -EINVAL;
+
+	d->n = n;
+	d->state = seed;
+	d->next = 0;
+	d->prob = NULL;
+	d->alias = NULL;
+
+	if (d->type == DIST_ZIPF)
+		return zipf_init(d);
+
+	return 0;
+}
+
+void dist_free(struct dist *d)
+{
+	free(d->prob);
+	free(d->alias);
+	d->prob = NULL;
+	d->alias = NULL;
+}
+
+static unsigned long long zipf_next(struct dist *d)
+{
+	double x = dist_uniform(d) * d->ranks;
+	unsigned long long i = x, block;
+
+	if (i >= d->ranks)
+		i = d->ranks - 1;
+	if (x - i >= d->prob[i])
+		i = d->alias[i];
+
+	block = i * d->group + uniform_below(d, d->group);
+	return block < d->n ? block : d->n - 1;
+}
+
+unsigned long long dist_next(struct dist *d, unsigned long long step)
+{
+	unsigned long long hot, block;
+
+	switch (d->type) {
+	case DIST_SEQ:
+		block = d->next % d->n;
+		d->next = block + step;
+		return block;
+
+	case DIST_ZIPF:
+		return zipf_next(d);
+
+	case DIST_HOTCOLD:
+		hot = d->n * d->hot / 100;
+		if (!hot)
+			hot = 1;
+		if (hot >= d->n)
+			return uniform_below(d, d->n);
+		if (dist_uniform(d) * 100 < d->share)
+			return uniform_below(d, hot);
+		return hot + uniform_below(d, d->n - hot);
+
+	case DIST_UNIFORM:
+	default:
+		return uniform_below(d, d->n);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef FLASHBENCH_DIST_H
+#define FLASHBENCH_DIST_H
+
+/*
+ * Access distributions
+ *
+ * Pick block numbers 0 .. n-1 for a workload: uniformly, in order,
+ * zipfian with skew theta where block 0 is the most popular one,
+ * or hot/cold, where the first hot percent of the blocks get share
+ * percent of all accesses. The same seed gives the same sequence.
+ */
+enum dist_type {
+	DIST_UNIFORM,
+	DIST_SEQ,
+	DIST_ZIPF,
+	DIST_HOTCOLD,
+};
+
+struct dist {
+	enum dist_type type;
+	double theta;			/* DIST_ZIPF */
+	unsigned int hot, share;	/* DIST_HOTCOLD, in percent */
+
+	unsigned long long n;
+	unsigned long long state;	/* of the random numbers */
+	unsigned long long next;	/* DIST_SEQ */
+
+	/*
+	 * Zipfian ranks, each covering group blocks, so the table has
+	 * at most DIST_MAX_RANKS entries no matter how large n is. A
+	 * rank is drawn from a Vose alias table in constant time: pick
+	 * any entry i, and keep it with probability prob[i], or take
+	 * alias[i] instead.
+	 */
+	double *prob;
+	unsigned int *alias;
+	unsigned long long ranks, group;
+};
+
+#define DIST_MAX_RANKS	(1 << 20)
+
+/* "uniform", "seq", "zipf[:theta]" or "hotcold[:hot:share]" */
+extern int dist_parse(struct dist *d, const char *spec);
+
+extern int dist_init(struct dist *d, unsigned long long n,
+		     unsigned long long seed);
+extern void dist_free(struct dist *d);
+
+/* the next block, a sequential one advances by step blocks */
+extern unsigned long long dist_next(struct dist *d, unsigned long long step);
+
+/* uniform in [0, 1), from the same random numbers */
+extern double dist_uniform(struct dist *d);
+
+#endif /* FLASHBENCH_DIST_H */
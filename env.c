@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "env.h"
+
+/* a list like "0-3,8,10-11", as used by sysfs and procfs */
+static int parse_cpulist(const char *s, cpu_set_t *set)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+	while (*s && *s != '\n') {
+		first = strtoul(s, &end, 10);
+		if (end == s)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 10);
+			if (end == s || last < first)
+				return -EINVAL;
+		}
+		if (last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		s = end;
+		if (*s == ',')
+			s++;
+	}
+
+	return 0;
+}
+
+static int read_cpulist(const char *path, cpu_set_t *set)
+{
+	char buf[1024];
+	FILE *f;
+	int ret = -ENOENT;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	if (fgets(buf, sizeof(buf), f))
+		ret = parse_cpulist(buf, set);
+	fclose(f);
+
+	return ret;
+}
+
+int env_cpus(const char *list, cpu_set_t *set)
+{
+	if (list)
+		return parse_cpulist(list, set) ? -EINVAL : 1;
+
+	if (!read_cpulist("/sys/devices/system/cpu/isolated", set) &&
+	    CPU_COUNT(set))
+		return 1;
+
+	if (sched_getaffinity(0, sizeof(*set), set))
+		return -errno;
+
+	return 0;
+}
+
+static void irq_cpus(unsigned int irq, cpu_set_t *cpus)
+{
+	char path[64];
+	cpu_set_t set;
+
+	snprintf(path, sizeof(path), "/proc/irq/%u/effective_affinity_list", irq);
+	if (read_cpulist(path, &set)) {
+		snprintf(path, sizeof(path), "/proc/irq/%u/smp_affinity_list", irq);
+		if (read_cpulist(path, &set))
+			return;
+	}
+
+	CPU_OR(cpus, cpus, &set);
+}
+
+/* interrupts of a device in sysfs, false if it has none */
+static bool device_irqs(const char *dir, cpu_set_t *cpus)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	unsigned int irq;
+	bool found = false;
+	DIR *msi = NULL;
+	FILE *f;
+
+	/* a path that does not fit cannot exist either */
+	if (snprintf(path, sizeof(path), "%s/msi_irqs", dir) < (int)sizeof(path))
+		msi = opendir(path);
+	if (msi) {
+		while ((d = readdir(msi))) {
+			if (sscanf(d->d_name, "%u", &irq) == 1) {
+				irq_cpus(irq, cpus);
+				found = true;
+			}
+		}
+		closedir(msi);
+		if (found)
+			return true;
+	}
+
+	if (snprintf(path, sizeof(path), "%s/irq", dir) >= (int)sizeof(path))
+		return false;
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+	if (fscanf(f, "%u", &irq) == 1 && irq) {
+		irq_cpus(irq, cpus);
+		found = true;
+	}
+	fclose(f);
+
+	return found;
+}
+
+/*
+ * The block device itself has no interrupts, so walk up from it
+ * in sysfs until we reach the controller that has some. For a
+ * regular file, that is the device of the file system.
+ */
+static void block_irqs(const char *filename, cpu_set_t *cpus)
+{
+	char link[64], path[PATH_MAX], *p;
+	struct stat st;
+	dev_t dev;
+
+	CPU_ZERO(cpus);
+	if (stat(filename, &st))
+		return;
+
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(dev), minor(dev));
+	if (!realpath(link, path))
+		return;
+
+	while (strlen(path) > strlen("/sys/devices")) {
+		if (device_irqs(path, cpus))
+			return;
+		p = strrchr(path, '/');
+		if (!p)
+			return;
+		*p = '\0';
+	}
+}
+
+int env_pick_cpu(const cpu_set_t *set, const char *filename,
+		 bool irq_aware, int nth)
+{
+	cpu_set_t cpus = *set, irq;
+	int cpu, count;
+
+	if (irq_aware) {
+		block_irqs(filename, &irq);
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &irq))
+				CPU_CLR(cpu, &cpus);
+		if (!CPU_COUNT(&cpus))
+			cpus = *set;
+	}
+
+	count = CPU_COUNT(&cpus);
+	if (!count)
+		return -1;
+
+	nth %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &cpus) && !nth--)
+			return cpu;
+
+	return -1;
+}
+
+int env_pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void set_rtprio(void)
+{
+	int ret;
+	struct sched_param p = {
+		.sched_priority = 10,
+	};
+	ret = sched_setscheduler(0, SCHED_FIFO, &p);
+	if (ret)
+		perror("sched_setscheduler");
+}
+
+int env_lock_memory(void)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		return -errno;
+
+	return 0;
+}
+
+void env_usage(struct env_usage *u)
+{
+	struct rusage ru;
+
+	memset(u, 0, sizeof(*u));
+	if (getrusage(RUSAGE_THREAD, &ru))
+		return;
+
+	u->nvcsw = ru.ru_nvcsw;
+	u->nivcsw = ru.ru_nivcsw;
+	u->minflt = ru.ru_minflt;
+	u->majflt = ru.ru_majflt;
+}
+
+void env_usage_since(const struct env_usage *start, struct env_usage *u)
+{
+	env_usage(u);
+	u->nvcsw -= start->nvcsw;
+	u->nivcsw -= start->nivcsw;
+	u->minflt -= start->minflt;
+	u->majflt -= start->majflt;
+}
@@ -0,0 +1,52 @@
+#ifndef FLASHBENCH_ENV_H
+#define FLASHBENCH_ENV_H
+
+#include <sched.h>
+#include <stdbool.h>
+
+/*
+ * Execution environment
+ *
+ * Things that keep the scheduler and the memory manager from
+ * showing up in the measurements: real-time priority, running on
+ * a CPU of its own, away from the interrupts of the device under
+ * test, and memory that is locked and faulted in before any test.
+ */
+
+/*
+ * The CPUs to run on: those in list, or else the isolated CPUs,
+ * or else any CPU we may run on. Returns 1 if the set comes from
+ * the list or from isolated CPUs, 0 for the default.
+ */
+extern int env_cpus(const char *list, cpu_set_t *set);
+
+/*
+ * The nth CPU of set, wrapping around. With irq_aware, CPUs that
+ * handle interrupts of the device holding filename are left out,
+ * unless that leaves none.
+ */
+extern int env_pick_cpu(const cpu_set_t *set, const char *filename,
+			bool irq_aware, int nth);
+
+/* pin the calling thread */
+extern int env_pin(int cpu);
+
+/* SCHED_FIFO for the calling thread */
+extern void set_rtprio(void);
+
+/* keep all current and future memory resident */
+extern int env_lock_memory(void);
+
+/* what the scheduler and the memory manager did to this thread */
+struct env_usage {
+	long nvcsw;		/* voluntary context switches */
+	long nivcsw;		/* involuntary context switches */
+	long minflt;
+	long majflt;
+};
+
+extern void env_usage(struct env_usage *u);
+extern void env_usage_since(const struct env_usage *start,
+			    struct env_usage *u);
+
+#endif /* FLASHBENCH_ENV_H */
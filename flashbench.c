@@ -11,10 +11,22 @@
 #include <errno.h>
 #include <limits.h>
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "dev.h"
+#include "dist.h"
+#include "env.h"
+#include "perm.h"
+#include "report.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
 #include "vm.h"
 
 typedef long long ns_t;
@@ -88,7 +100,7 @@ static inline void print_ns(ns_t ns)
 {
 	char buf[8];
 	format_ns(buf, ns);
-	puts(buf);
+	report_printf("%s\n", buf);
 }
 
 static void regression(ns_t ns[], off_t bytes[], int count, ns_t *atime, float *throughput)
@@ -111,54 +123,99 @@ static void regression(ns_t ns[], off_t bytes[], int count, ns_t *atime, float *
 		(float)(count * sum_xx - sum_x * sum_x);
 	intercept = (sum_y - slope * sum_x) / count;
 
-	format_ns(buf, intercept);
-	printf("%g MB/s, %s access time\n", 1000.0 / slope, buf);
+	if (report_text()) {
+		format_ns(buf, intercept);
+		report_printf("%g MB/s, %s access time\n", 1000.0 / slope, buf);
+	} else {
+		report_begin("interval-fit");
+		report_float("throughput_mbps", 1000.0 / slope);
+		report_float("access_ns", intercept);
+		report_end();
+	}
 
 	*atime = intercept;
 	*throughput = 1000.0 / slope;
 }
 
+/*
+ * hist is optional and collects every single sample. With adaptive
+ * sampling, each position is read until its median is known well
+ * enough, otherwise it is read once.
+ */
 static int time_read_interval(struct device *dev, int count, ns_t results[],
-				 size_t size, off_t offset, off_t interval)
+				 size_t size, off_t offset, off_t interval,
+				 struct hist *hist)
 {
 	int i;
 	off_t pos;
 	ns_t ret;
+	long long buf[sample_policy.max];
+	struct sampler sampler;
+	bool done = true;
 
 	for (i=0; i < count; i++) {
 		pos = offset + i * interval;
-		ret = time_read(dev, pos, size);
-		returnif (ret);
+		sampler_init(&sampler, buf, sample_policy.max);
+		do {
+			ret = time_read(dev, pos, size);
+			returnif (ret);
+
+			if (hist)
+				hist_add(hist, ret);
 
-		if (results[i] == 0 || results[i] > ret)
-			results[i] = ret;
+			if (results[i] == 0 || results[i] > ret)
+				results[i] = ret;
+
+			if (sampling_adaptive())
+				done = sampler_add(&sampler, ret);
+		} while (!done);
 	}
 
 	return 0;
 }
 
-static void print_one_blocksize(int count, ns_t *times, off_t blocksize)
+static void print_one_blocksize(int count, ns_t *times, struct hist *hist,
+				off_t blocksize)
 {
-	char min[8], avg[8], max[8];
+	char min[8], avg[8], p99[8], p999[8], max[8];
+
+	if (!report_text()) {
+		report_begin("interval");
+		report_num("size", blocksize);
+		report_num("min_ns", ns_min(count, times));
+		report_num("avg_ns", ns_avg(count, times));
+		report_num("p99_ns", hist_percentile(hist, 9900));
+		report_num("p99.9_ns", hist_percentile(hist, 9990));
+		report_num("max_ns", ns_max(count, times));
+		report_end();
+		return;
+	}
 
 	format_ns(min, ns_min(count, times));
 	format_ns(avg, ns_avg(count, times));
+	format_ns(p99, hist_percentile(hist, 9900));
+	format_ns(p999, hist_percentile(hist, 9990));
 	format_ns(max, ns_max(count, times));
 
-	printf("%lld bytes: min %s avg %s max %s: %g MB/s\n", (long long)blocksize,
-		 min, avg, max, blocksize / (ns_min(count, times) / 1000.0));
+	report_printf("%lld bytes: min %s avg %s p99 %s p99.9 %s max %s: %g MB/s\n",
+		 (long long)blocksize, min, avg, p99, p999, max,
+		 blocksize / (ns_min(count, times) / 1000.0));
 }
 
 static int try_interval(struct device *dev, long blocksize, ns_t *min_time, int count)
 {
 	int ret;
 	ns_t times[count];
+	struct hist hist;
+
 	memset(times, 0, sizeof(times));
+	hist_init(&hist);
 
-	ret = time_read_interval(dev, count, times, blocksize, 0, blocksize * 9);
+	ret = time_read_interval(dev, count, times, blocksize, 0, blocksize * 9,
+				 &hist);
 	returnif (ret);
 
-	print_one_blocksize(count, times, blocksize);
+	print_one_blocksize(count, times, &hist, blocksize);
 	*min_time = ns_min(count, times);
 
 	return 0;
@@ -182,7 +239,16 @@ static int try_intervals(struct device *dev, int count, int rounds)
 	regression(min + ignore, bytes + ignore, rounds - ignore, &atime, &throughput);
 
 	for (i=0; i<rounds; i++) {
-		printf("bytes %lld, time %lld overhead %g\n", (long long)bytes[i], min[i],
+		if (!report_text()) {
+			report_begin("interval-overhead");
+			report_num("size", bytes[i]);
+			report_num("time_ns", min[i]);
+			report_float("overhead_ns", min[i] - atime -
+				     bytes[i] * 1000 / throughput);
+			report_end();
+			continue;
+		}
+		report_printf("bytes %lld, time %lld overhead %g\n", (long long)bytes[i], min[i],
 			min[i] - atime - bytes[i] * 1000 / throughput);
 	}
 
@@ -190,93 +256,715 @@ static int try_intervals(struct device *dev, int count, int rounds)
 }
 
 /*
- * Linear feedback shift register
+ * With adaptive sampling, every round only reads the blocks whose
+ * median is not yet known well enough, until none are left.
+ */
+static int try_scatter_io(struct device *dev, int tries, int scatter_order,
+			int scatter_span, int blocksize, FILE *out)
+{
+	int i, j, ret = 0;
+	const int count = 1 << scatter_order;
+	ns_t time;
+	ns_t *min;
+	unsigned long pos;
+	struct io_request *req;
+	struct sampler *sampler = NULL;
+	long long *samples = NULL;
+	struct perm perm;
+	int active = count;
+
+	req = calloc(count, sizeof(*req));
+	min = calloc(count, sizeof(*min));
+	if (!req || !min) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (sampling_adaptive()) {
+		sampler = calloc(count, sizeof(*sampler));
+		samples = calloc((size_t)count * sample_policy.max,
+				 sizeof(*samples));
+		if (!sampler || !samples) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		for (j = 0; j < count; j++)
+			sampler_init(&sampler[j], samples + (size_t)j * sample_policy.max,
+				     sample_policy.max);
+	}
+
+	perm_init(&perm, count, perm_seed);
+	for (j = 0; j < count; j++) {
+		req[j].pos = (off_t)perm_map(&perm, j) * blocksize;
+		req[j].size = scatter_span * blocksize;
+		req[j].dir = IO_READ;
+	}
+
+	for (i = 0; active && (sampler || i < tries); i++) {
+		time = time_queue(dev, req, active);
+		if (time < 0) {
+			ret = time;
+			goto out;
+		}
+
+		for (j = 0; j < active; j++) {
+			pos = req[j].pos / blocksize;
+			if (i == 0 || req[j].ns < min[pos])
+				min[pos] = req[j].ns;
+
+			/* drop finished blocks from the next round */
+			if (sampler && sampler_add(&sampler[pos], req[j].ns))
+				req[j--] = req[--active];
+		}
+	}
+
+	for (j = 0; j < count; j++) {
+		if (!report_text()) {
+			report_begin("scatter");
+			report_num("pos", (long long)j * blocksize);
+			report_num("min_ns", min[j]);
+			report_end();
+			continue;
+		}
+		fprintf(out, "%f	%f\n", j * blocksize / (1024 * 1024.0), min[j] / 1000000.0);
+	}
+
+out:
+	free(req);
+	free(min);
+	free(sampler);
+	free(samples);
+	return ret;
+}
+
+struct completion {
+	long long end, ns;
+};
+
+static int cmp_end(const void *a, const void *b)
+{
+	const struct completion *x = a, *y = b;
+
+	return (x->end > y->end) - (x->end < y->end);
+}
+
+/*
+ * 64 requests per try, but at least 64 for each one in flight. Only
+ * the steady state counts: the first qd completions, while the queue
+ * fills up, and the last qd, while it drains, are left out of both
+ * the throughput and the latencies.
+ */
+static int try_qd_step(struct device *dev, struct io_request *req, int count,
+			unsigned int qd, size_t blocksize, enum io_dir dir)
+{
+	struct completion *c;
+	ns_t total, first, last;
+	struct hist hist;
+	char med_s[8], p99_s[8];
+	int i, ret, steady;
+
+	ret = setup_async(dev, qd);
+	returnif(ret);
+
+	if (count < (int)qd * 64)
+		count = qd * 64;
+	for (i = 0; i < count; i++)
+		req[i].dir = dir;
+
+	total = time_queue(dev, req, count);
+	returnif(total);
+
+	c = malloc(count * sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		c[i].end = req[i].start + req[i].ns;
+		c[i].ns = req[i].ns;
+	}
+	qsort(c, count, sizeof(*c), cmp_end);
+
+	first = qd - 1;
+	last = count - qd - 1;
+	steady = last - first;
+	total = c[last].end - c[first].end;
+	if (total <= 0)
+		total = 1;
+
+	hist_init(&hist);
+	for (i = first + 1; i <= last; i++)
+		hist_add(&hist, c[i].ns);
+	free(c);
+
+	if (!report_text()) {
+		report_begin("qd");
+		report_num("qd", qd);
+		report_str("dir", dir == IO_READ ? "read" : "write");
+		report_num("size", blocksize);
+		report_float("iops", steady * 1000000000.0 / total);
+		report_float("mbps", steady * (double)blocksize * 1000.0 / total);
+		report_num("median_ns", hist_percentile(&hist, 5000));
+		report_num("p99_ns", hist_percentile(&hist, 9900));
+		report_end();
+		return 0;
+	}
+
+	format_ns(med_s, hist_percentile(&hist, 5000));
+	format_ns(p99_s, hist_percentile(&hist, 9900));
+
+	report_printf("qd %d\t%s\t%.0f IOPS\t%.2f MB/s\tmedian %s\tp99 %s\n",
+		qd, dir == IO_READ ? "read" : "write",
+		steady * 1000000000.0 / total,
+		steady * (double)blocksize * 1000.0 / total, med_s, p99_s);
+
+	return 0;
+}
+
+/*
+ * Run the same random read and random write pattern at increasing
+ * queue depth, to show where the device stops scaling. Every depth,
+ * one included, goes through the engine's queue, so the numbers only
+ * differ by the depth.
+ */
+static int try_qd_sweep(struct device *dev, int tries, unsigned int max_qd,
+			size_t blocksize, unsigned long long offset)
+{
+	const int count = tries * 64;
+	unsigned int qd, saved_qd = dev->qd;
+	unsigned int most = count;
+	unsigned long long blocks;
+	struct io_request *req;
+	struct perm perm;
+	int i, ret = 0;
+
+	if (offset == -1ull)
+		offset = 1024 * 1024 * 16;
+	if (dev->size <= (off_t)(offset + blocksize))
+		return -EINVAL;
+
+	/* the deepest step does the most requests, see try_qd_step */
+	for (qd = 1; qd <= max_qd; qd *= 2)
+		if (qd * 64 > most)
+			most = qd * 64;
+
+	/*
+	 * distinct random blocks across the rest of the device, only
+	 * starting over when a step has more requests than there are
+	 */
+	blocks = (dev->size - offset) / blocksize;
+	perm_init(&perm, blocks, perm_seed);
+
+	req = calloc(most, sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+
+	for (i = 0; i < (int)most; i++) {
+		req[i].pos = offset + perm_map(&perm, i % blocks) * blocksize;
+		req[i].size = blocksize;
+		req[i].which = WBUF_RAND;
+	}
+
+	for (qd = 1; qd <= max_qd; qd *= 2) {
+		ret = try_qd_step(dev, req, count, qd, blocksize, IO_READ);
+		if (ret < 0)
+			break;
+
+		ret = try_qd_step(dev, req, count, qd, blocksize, IO_WRITE);
+		if (ret < 0)
+			break;
+	}
+
+	free(req);
+	setup_qd(dev, saved_qd);
+
+	return ret;
+}
+
+/*
+ * Mixed workload
  *
- * We use this to randomize the block positions for random-access
- * tests. Unlike real random data, we know that within 2^bits
- * accesses, every possible value up to 2^bits will be seen
- * exactly once, with the exception of zero, for which we have
- * a special treatment.
+ * A fixed number of requests, each of them a read or a write of
+ * random data at a block size picked by weight from a list like
+ * "4K:80,64K:20", at a block chosen by an access distribution over
+ * the device, aligned to the smallest block size. All requests are
+ * generated before the first one is timed, and then run through
+ * time_queue at the selected queue depth.
  */
-static int lfsr(unsigned short v, unsigned int bits)
+#define MIX_SIZES 8
+
+struct mix_size {
+	size_t size;
+	unsigned int weight;
+};
+
+static int parse_mix_sizes(const char *spec, struct mix_size *sizes)
 {
-	unsigned short bit;
+	const char *p = spec;
+	char *end;
+	int nr = 0;
+
+	while (*p) {
+		if (nr == MIX_SIZES)
+			return -EINVAL;
+
+		sizes[nr].size = strtoull(p, &end, 0);
+		switch (*end) {
+		case 'M':
+			sizes[nr].size *= 1024;
+			/* fall through */
+		case 'K':
+			sizes[nr].size *= 1024;
+			end++;
+		}
+
+		sizes[nr].weight = 1;
+		if (*end == ':')
+			sizes[nr].weight = strtoul(end + 1, &end, 10);
 
-	if (v >= (1 << bits)) {
-		fprintf(stderr, "flashbench: internal error\n");
-		exit(-EINVAL);
+		if (end == p || (*end && *end != ',') || !sizes[nr].size ||
+		    sizes[nr].size % 512 || !sizes[nr].weight)
+			return -EINVAL;
+
+		nr++;
+		p = *end ? end + 1 : end;
 	}
 
-	if (v == 0)
-		v = ((1 << bits) - 1) & 0xace1;
+	return nr ? nr : -EINVAL;
+}
 
-	switch (bits) {
-	case 8: /* x^8 + x^6 + x^5 + x^4 + 1 */
-		bit = ((v >> 0) ^ (v >> 2) ^ (v >> 3) ^ (v >> 4)) & 1;
-		break;
-	case 9: /* x9 + x5 + 1 */
-		bit = ((v >> 0) ^ (v >> 4)) & 1;
-		break;
-	case 10: /* x10 + x7 + 1 */
-		bit = ((v >> 0) ^ (v >> 3)) & 1;
-		break;
-	case 11: /* x11 + x9 + 1 */
-		bit = ((v >> 0) ^ (v >> 2)) & 1;
-		break;
-	case 12:
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 8)) & 1;
-		break;
-	case 13: /* x^13 + x^12 + x^11 + x^8 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 5)) & 1;
-		break;
-	case 14: /* x^14 + x^13 + x^12 + x^2 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 12)) & 1;
-		break;
-	case 15: /* x^15 + x^14 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ) & 1;
-		break;
-	case 16: /* x^16 + x^14 + x^13 + x^11 + 1 */
-		bit = ((v >> 0) ^ (v >> 2) ^ (v >> 3) ^ (v >> 5) ) & 1;
-		break;
-	default:
-		fprintf(stderr, "flashbench: internal error\n");
-		exit(-EINVAL);
+static void print_mix_class(enum io_dir dir, size_t size, struct hist *hist)
+{
+	char min[8], med[8], p99[8], max[8];
+	const char *name = dir == IO_READ ? "read" : "write";
+
+	if (!report_text()) {
+		report_begin("mixed-class");
+		report_str("dir", name);
+		report_num("size", size);
+		report_num("ops", hist->count);
+		report_num("min_ns", hist->min);
+		report_num("median_ns", hist_percentile(hist, 5000));
+		report_num("p99_ns", hist_percentile(hist, 9900));
+		report_num("max_ns", hist->max);
+		report_end();
+		return;
 	}
 
-	return v >> 1 | bit << (bits - 1);
+	format_ns(min, hist->min);
+	format_ns(med, hist_percentile(hist, 5000));
+	format_ns(p99, hist_percentile(hist, 9900));
+	format_ns(max, hist->max);
+
+	report_printf("%s\t%zu bytes\t%llu ops\tmin %s\tmedian %s\tp99 %s\tmax %s\n",
+		      name, size, hist->count, min, med, p99, max);
 }
 
-static int try_scatter_io(struct device *dev, int tries, int scatter_order,
-			int scatter_span, int blocksize, FILE *out)
+static int try_mixed(struct device *dev, int ops, unsigned int read_pct,
+		     const char *size_spec, size_t blocksize,
+		     const char *dist_spec, unsigned long long offset)
 {
-	int i, j;
-	const int count = 1 << scatter_order;
-	ns_t time;
-	ns_t min[count];
-	unsigned long pos;
+	struct mix_size sizes[MIX_SIZES];
+	struct hist *hist = NULL;
+	struct io_request *req = NULL;
+	unsigned char *class = NULL;
+	size_t unit, largest;
+	unsigned long long bytes = 0, weights = 0;
+	unsigned int pick;
+	struct dist dist;
+	ns_t total;
+	int nr, i, c, ret = 0;
+
+	if (size_spec) {
+		nr = parse_mix_sizes(size_spec, sizes);
+		if (nr < 0)
+			return nr;
+	} else {
+		sizes[0].size = blocksize;
+		sizes[0].weight = 1;
+		nr = 1;
+	}
 
-	memset(min, 0, sizeof(min));
-	for (i = 0; i < tries; i++) {
-		pos = 0;
-		for (j = 0; j < count; j++) {
-			time = time_read(dev, (pos * blocksize), scatter_span * blocksize);
-			returnif (time);
+	unit = largest = sizes[0].size;
+	for (i = 0; i < nr; i++) {
+		if (sizes[i].size < unit)
+			unit = sizes[i].size;
+		if (sizes[i].size > largest)
+			largest = sizes[i].size;
+		weights += sizes[i].weight;
+	}
+
+	if (offset == -1ull)
+		offset = 1024 * 1024 * 16;
+	if (dev->size < (off_t)(offset + largest))
+		return -EINVAL;
+
+	if (dist_parse(&dist, dist_spec ? dist_spec : "uniform"))
+		return -EINVAL;
+	ret = dist_init(&dist, (dev->size - offset - largest) / unit + 1,
+			perm_seed);
+	returnif(ret);
+
+	req = calloc(ops, sizeof(*req));
+	class = calloc(ops, sizeof(*class));
+	hist = calloc(2 * nr, sizeof(*hist));
+	if (!req || !class || !hist) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < ops; i++) {
+		pick = dist_uniform(&dist) * weights;
+		for (c = 0; c < nr - 1 && pick >= sizes[c].weight; c++)
+			pick -= sizes[c].weight;
+
+		req[i].dir = dist_uniform(&dist) * 100 < read_pct ?
+			     IO_READ : IO_WRITE;
+		req[i].which = WBUF_RAND;
+		req[i].size = sizes[c].size;
+		req[i].pos = offset + dist_next(&dist, sizes[c].size / unit) * unit;
+		class[i] = req[i].dir == IO_READ ? c : nr + c;
+		bytes += req[i].size;
+	}
+
+	reserve_buffers(dev, largest);
+	total = time_queue(dev, req, ops);
+	if (total < 0) {
+		ret = total;
+		goto out;
+	}
+
+	for (c = 0; c < 2 * nr; c++)
+		hist_init(&hist[c]);
+	for (i = 0; i < ops; i++)
+		hist_add(&hist[class[i]], req[i].ns);
+
+	if (!report_text()) {
+		report_begin("mixed");
+		report_num("ops", ops);
+		report_num("read_pct", read_pct);
+		report_str("dist", dist_spec ? dist_spec : "uniform");
+		report_num("ns", total);
+		report_float("iops", ops * 1000000000.0 / total);
+		report_float("mbps", bytes * 1000.0 / total);
+		report_end();
+	} else {
+		report_printf("%d ops, %u%% read, %s: %.0f IOPS, %.2f MB/s\n",
+			      ops, read_pct, dist_spec ? dist_spec : "uniform",
+			      ops * 1000000000.0 / total, bytes * 1000.0 / total);
+	}
+
+	for (c = 0; c < 2 * nr; c++)
+		if (hist[c].count)
+			print_mix_class(c < nr ? IO_READ : IO_WRITE,
+					sizes[c % nr].size, &hist[c]);
+
+out:
+	dist_free(&dist);
+	free(hist);
+	free(class);
+	free(req);
+	return ret;
+}
+
+/*
+ * Sustained writes
+ *
+ * Many cards first write to a fast cache, which only holds part of
+ * their capacity. Write across the whole span, in order or in a
+ * pseudorandom order with --random, and measure the throughput of
+ * each window of that many bytes. The cache is full at the first
+ * change point where the throughput drops, and what comes after it
+ * is the steady state. As in guess_alignment, the noise is not
+ * allowed to be below 2% of the range of the throughput.
+ */
+static void print_sustained_window(int i, unsigned long long written,
+				   double mbps)
+{
+	if (!report_text()) {
+		report_begin("sustained-window");
+		report_num("window", i);
+		report_num("written", written);
+		report_float("mbps", mbps);
+		report_end();
+		return;
+	}
+
+	report_printf("%llu MB\t%.2f MB/s\n", written >> 20, mbps);
+}
+
+static int try_sustained(struct device *dev, unsigned long long span,
+			 unsigned long long window, size_t blocksize,
+			 unsigned long long offset, bool random)
+{
+	const double threshold = 5.0;
+	unsigned long long blocks, per_window, block = 0, cache = 0;
+	unsigned long long burst_bytes = 0, steady_bytes = 0;
+	double *mbps = NULL, noise, hi = -HUGE_VAL, lo = HUGE_VAL;
+	ns_t *ns = NULL, burst_ns = 0, steady_ns = 0;
+	struct change_point *cp = NULL;
+	struct io_request *req = NULL;
+	struct perm perm;
+	unsigned int i, j, n, nr, first;
+	int ret = 0;
+
+	if (offset == -1ull)
+		offset = 1024 * 1024 * 16;
+	if (dev->size <= (off_t)(offset + blocksize)) {
+		fprintf(stderr, "sustained: offset %llu leaves no room for a block\n",
+			offset);
+		return -EINVAL;
+	}
+	if (!span || span > dev->size - offset)
+		span = dev->size - offset;
+
+	blocks = span / blocksize;
+	if (!window)
+		window = span / 128;
+	per_window = window / blocksize;
+	if (!per_window)
+		per_window = 1;
+	if (per_window > blocks || per_window > UINT_MAX) {
+		fprintf(stderr, "sustained: a window of %llu bytes does not fit in a span of %llu bytes\n",
+			per_window * blocksize, span);
+		return -EINVAL;
+	}
+	n = blocks / per_window;
 
-			if (i == 0 || time < min[pos])
-				min[pos] = time;
+	perm_init(&perm, blocks, perm_seed);
+
+	req = calloc(per_window, sizeof(*req));
+	mbps = calloc(n, sizeof(*mbps));
+	ns = calloc(n, sizeof(*ns));
+	cp = calloc(n, sizeof(*cp));
+	if (!req || !mbps || !ns || !cp) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < per_window; j++, block++) {
+			req[j].pos = offset + (random ? perm_map(&perm, block) :
+					       block) * blocksize;
+			req[j].size = blocksize;
+			req[j].dir = IO_WRITE;
+			req[j].which = WBUF_RAND;
+		}
 
-			pos = lfsr(pos, scatter_order);
+		ns[i] = time_queue(dev, req, per_window);
+		if (ns[i] < 0) {
+			ret = ns[i];
+			goto out;
 		}
+
+		mbps[i] = per_window * (double)blocksize * 1000.0 / ns[i];
+		if (mbps[i] > hi)
+			hi = mbps[i];
+		if (mbps[i] < lo)
+			lo = mbps[i];
+
+		print_sustained_window(i, (i + 1) * per_window * blocksize,
+				       mbps[i]);
 	}
 
-	for (j = 0; j < count; j++) {
-		fprintf(out, "%f	%f\n", j * blocksize / (1024 * 1024.0), min[j] / 1000000.0);
+	noise = noise_estimate(mbps, n);
+	if (noise < (hi - lo) * 0.02)
+		noise = (hi - lo) * 0.02;
+
+	nr = change_points(mbps, n, noise, threshold, cp, n);
+	for (first = 0; first < nr; first++)
+		if (cp[first].before > cp[first].after)
+			break;
+
+	for (i = 0; i < n; i++) {
+		if (first < nr && i >= cp[first].index) {
+			steady_ns += ns[i];
+			steady_bytes += per_window * blocksize;
+		} else {
+			burst_ns += ns[i];
+			burst_bytes += per_window * blocksize;
+		}
+	}
+	if (first < nr)
+		cache = burst_bytes;
+
+	if (!report_text()) {
+		report_begin("sustained");
+		report_num("written", burst_bytes + steady_bytes);
+		report_num("window", per_window * blocksize);
+		report_num("cache_bytes", cache);
+		report_float("burst_mbps", burst_bytes * 1000.0 / burst_ns);
+		if (cache) {
+			report_float("steady_mbps", steady_bytes * 1000.0 / steady_ns);
+			report_float("score", cp[first].score);
+		}
+		report_end();
+	} else if (cache) {
+		report_printf("cache full after %llu MB, %.2f MB/s before, "
+			      "%.2f MB/s steady state, score %.1f\n",
+			      cache >> 20, burst_bytes * 1000.0 / burst_ns,
+			      steady_bytes * 1000.0 / steady_ns, cp[first].score);
+	} else {
+		report_printf("no cache found in %llu MB, %.2f MB/s\n",
+			      burst_bytes >> 20, burst_bytes * 1000.0 / burst_ns);
 	}
 
-	return 0;
+out:
+	free(cp);
+	free(ns);
+	free(mbps);
+	free(req);
+	return ret;
+}
+
+/*
+ * Replay
+ *
+ * Do the requests of a trace through the usual time_queue path,
+ * either one after the other as fast as --qd allows, or each one
+ * at the time it was recorded. Offsets that are not on the device
+ * wrap around, and all requests are aligned to 512 bytes, as needed
+ * for direct I/O. The result is the total time, and the latency of
+ * each type of request, which is measured from its submission, so
+ * a device that falls behind the trace in timed mode shows up in
+ * how late the requests were submitted instead.
+ */
+static void print_replay_class(enum io_dir dir, struct hist *hist)
+{
+	static const char *names[] = { "read", "write", "erase" };
+	char med[8], p99[8], p999[8], max[8];
+
+	if (!report_text()) {
+		report_begin("replay-class");
+		report_str("dir", names[dir]);
+		report_num("ops", hist->count);
+		report_num("median_ns", hist_percentile(hist, 5000));
+		report_num("p99_ns", hist_percentile(hist, 9900));
+		report_num("p999_ns", hist_percentile(hist, 9990));
+		report_num("max_ns", hist->max);
+		report_end();
+		return;
+	}
+
+	format_ns(med, hist_percentile(hist, 5000));
+	format_ns(p99, hist_percentile(hist, 9900));
+	format_ns(p999, hist_percentile(hist, 9990));
+	format_ns(max, hist->max);
+
+	report_printf("%s\t%llu ops\tmedian %s\tp99 %s\tp99.9 %s\tmax %s\n",
+		      names[dir], hist->count, med, p99, p999, max);
+}
+
+static int try_replay(struct device *dev, const char *filename, bool timed)
+{
+	struct trace_record *recs;
+	struct io_request *req;
+	struct hist hist[3];
+	unsigned long long bytes = 0;
+	size_t largest = 0;
+	ns_t total, late = 0;
+	char total_s[8], late_s[8];
+	int i, nr, done, failed = 0, ret = 0;
+
+	/* there is no idle time on a simulated clock */
+	if (timed && dev->ops->now) {
+		report_printf("%s has a simulated clock, replaying at full speed\n",
+			      dev->ops->name);
+		timed = false;
+	}
+
+	nr = trace_load(filename, &recs);
+	if (nr < 0) {
+		fprintf(stderr, "%s: cannot load trace: %s\n", filename,
+			strerror(-nr));
+		return nr;
+	}
+
+	req = calloc(nr, sizeof(*req));
+	if (!req) {
+		free(recs);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr; i++) {
+		req[i].size = (recs[i].size + 511) & ~511ull;
+		if (req[i].size > MAX_BUFSIZE || (off_t)req[i].size > dev->size) {
+			fprintf(stderr, "%s: request %d of %zu bytes is too large\n",
+				filename, i, req[i].size);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		req[i].pos = (recs[i].pos % dev->size) & ~511ull;
+		if (req[i].pos + (off_t)req[i].size > dev->size)
+			req[i].pos = (dev->size - req[i].size) & ~511ull;
+
+		req[i].dir = recs[i].op;
+		req[i].which = WBUF_RAND;
+		req[i].at = timed ? recs[i].time : 0;
+
+		if (req[i].size > largest)
+			largest = req[i].size;
+	}
+
+	reserve_buffers(dev, largest);
+	total = time_queue(dev, req, nr);
+	if (total < 0) {
+		ret = total;
+		goto out;
+	}
+
+	/* only what was done counts, and a discard transfers nothing */
+	for (i = 0; i < 3; i++)
+		hist_init(&hist[i]);
+	for (i = 0; i < nr; i++) {
+		if (req[i].late > late)
+			late = req[i].late;
+		if (req[i].err) {
+			failed++;
+			continue;
+		}
+		hist_add(&hist[req[i].dir], req[i].ns);
+		if (req[i].dir != IO_ERASE)
+			bytes += req[i].size;
+	}
+	done = nr - failed;
+
+	if (!report_text()) {
+		report_begin("replay");
+		report_str("trace", filename);
+		report_str("mode", timed ? "timed" : "fast");
+		report_num("ops", done);
+		report_num("failed", failed);
+		report_num("bytes", bytes);
+		report_num("ns", total);
+		report_float("iops", done * 1000000000.0 / total);
+		report_float("mbps", bytes * 1000.0 / total);
+		if (timed)
+			report_num("max_late_ns", late);
+		report_end();
+	} else {
+		format_ns(total_s, total);
+		format_ns(late_s, late);
+		report_printf("%d ops, %s: %s, %.0f IOPS, %.2f MB/s", done,
+			      timed ? "timed" : "fast", total_s,
+			      done * 1000000000.0 / total, bytes * 1000.0 / total);
+		if (failed)
+			report_printf(", %d failed", failed);
+		if (timed)
+			report_printf(", up to %s late", late_s);
+		report_printf("\n");
+	}
+
+	for (i = 0; i < 3; i++)
+		if (hist[i].count)
+			print_replay_class(i, &hist[i]);
+
+out:
+	free(req);
+	free(recs);
+	return ret;
 }
 
-static unsigned int find_order(unsigned int large, unsigned int small)
+static unsigned int find_order(off_t large, off_t small)
 {
 	unsigned int o;
 
@@ -286,55 +974,267 @@ static unsigned int find_order(unsigned int large, unsigned int small)
 	return o;
 }
 
+struct align_result {
+	off_t align;
+	ns_t pre, on, post, diff;
+};
+
+/*
+ * Reads at each alignment are spaced by maxalign, and only as many
+ * are done as fit on the device: one that wraps around the end either
+ * repeats an earlier one or gets cut short at the end of the device,
+ * which shows up as a step in the diff column that is not there.
+ */
 static int try_read_alignment(struct device *dev, int tries, int count,
-				off_t maxalign, off_t align, size_t blocksize)
+				off_t maxalign, off_t align, size_t blocksize,
+				struct align_result *res)
 {
 	ns_t pre[count], on[count], post[count];
-	char pre_s[8], on_s[8], post_s[8], diff_s[8];
+	off_t fit;
 	int i, ret;
 
+	fit = (dev->size - align - (off_t)blocksize) / maxalign + 1;
+	if (fit < count)
+		count = fit;
+
 	memset(pre, 0, sizeof(pre));
 	memset(on, 0, sizeof(on));
 	memset(post, 0, sizeof(post));
 
+	/* time_read_interval repeats each read itself */
+	if (sampling_adaptive())
+		tries = 1;
+
 	for (i = 0; i < tries; i++) {
 		ret = time_read_interval(dev, count, pre, blocksize,
-					 align - blocksize, maxalign);
+					 align - blocksize, maxalign, NULL);
 		returnif(ret);
 
 		ret = time_read_interval(dev, count, on, blocksize,
-					 align - blocksize / 2, maxalign);
+					 align - blocksize / 2, maxalign, NULL);
 		returnif(ret);
 
 		ret = time_read_interval(dev, count, post, blocksize,
-					 align, maxalign);
+					 align, maxalign, NULL);
 		returnif(ret);
 	}
 
-	format_ns(pre_s,  ns_avg(count, pre));
-	format_ns(on_s,   ns_avg(count, on));
-	format_ns(post_s, ns_avg(count, post));
-	format_ns(diff_s, ns_avg(count, on) - (ns_avg(count, pre) + ns_avg(count, post)) / 2);
-	printf("align %lld\tpre %s\ton %s\tpost %s\tdiff %s\n", (long long)align, pre_s, on_s, post_s, diff_s);
+	res->align = align;
+	res->pre = ns_avg(count, pre);
+	res->on = ns_avg(count, on);
+	res->post = ns_avg(count, post);
+	res->diff = res->on - (res->pre + res->post) / 2;
 
 	return 0;
 }
 
-static int try_read_alignments(struct device *dev, int tries, int blocksize)
+static void print_alignment(struct align_result *res, int sweep)
+{
+	char pre_s[8], on_s[8], post_s[8], diff_s[8];
+
+	if (!report_text()) {
+		report_begin("align");
+		report_num("sweep", sweep);
+		report_num("align", res->align);
+		report_num("pre_ns", res->pre);
+		report_num("on_ns", res->on);
+		report_num("post_ns", res->post);
+		report_num("diff_ns", res->diff);
+		report_end();
+		return;
+	}
+
+	format_ns(pre_s,  res->pre);
+	format_ns(on_s,   res->on);
+	format_ns(post_s, res->post);
+	format_ns(diff_s, res->diff);
+	report_printf("align %lld\tpre %s\ton %s\tpost %s\tdiff %s\n",
+		(long long)res->align, pre_s, on_s, post_s, diff_s);
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	ns_t x = *(const ns_t *)a, y = *(const ns_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static ns_t ns_median(int count, ns_t data[])
+{
+	qsort(data, count, sizeof(ns_t), cmp_ns);
+
+	return data[count / 2];
+}
+
+/*
+ * The diff column stays high for all alignments that are a multiple
+ * of the erase block size, then drops to one or more lower plateaus,
+ * with the last step before the noise floor at the page size. Find
+ * these steps, ignoring any that go the other way. Crossing into
+ * another erase block costs the most, so the largest step is taken
+ * as the erase block size, wherever it is, and the last one below
+ * it as the page size. The noise is not allowed to be below 2% of
+ * the largest step, so a perfectly smooth series does not get split
+ * at every tiny difference.
+ *
+ * The confidence of each guess is the height of its step relative to
+ * that plus the next highest one that was not chosen, or the noise if
+ * there is none: 100% if the step is the only structure in the diff
+ * column, 50% if there is another one just as high.
+ */
+struct align_guess {
+	off_t size;
+	double score, conf;
+};
+
+static double step_height(const struct change_point *cp)
+{
+	return fabs(cp->before - cp->after);
+}
+
+static void guess_one(struct align_guess *g, struct align_result *res,
+		      const struct change_point *cp, double other)
+{
+	g->size = res[cp->index - 1].align;
+	g->score = cp->score;
+	g->conf = step_height(cp) / (step_height(cp) + other);
+}
+
+static void guess_alignment(struct align_result *res, int n,
+			    struct align_guess *erase, struct align_guess *page)
+{
+	const double threshold = 5.0;
+	struct change_point cp[n];
+	double diff[n], noise, range, other;
+	double hi = -HUGE_VAL, lo = HUGE_VAL;
+	int i, nr, big = -1, last = -1;
+
+	for (i = 0; i < n; i++) {
+		diff[i] = res[i].diff;
+		if (diff[i] > hi)
+			hi = diff[i];
+		if (diff[i] < lo)
+			lo = diff[i];
+	}
+	range = hi - lo;
+	noise = noise_estimate(diff, n);
+	if (noise < range * 0.02)
+		noise = range * 0.02;
+
+	nr = change_points(diff, n, noise, threshold, cp, n);
+	for (i = 0; i < nr; i++) {
+		if (cp[i].before <= cp[i].after)
+			continue;
+		if (big < 0 || cp[i].before - cp[i].after >
+			       cp[big].before - cp[big].after)
+			big = i;
+		last = i;
+	}
+
+	memset(erase, 0, sizeof(*erase));
+	memset(page, 0, sizeof(*page));
+	if (big < 0)
+		return;
+
+	/* noise is 0 only for a perfectly flat column, without steps */
+	other = noise;
+	for (i = 0; i < nr; i++)
+		if (i != big && i != last && step_height(&cp[i]) > other)
+			other = step_height(&cp[i]);
+
+	guess_one(erase, res, &cp[big], other);
+	if (last != big)
+		guess_one(page, res, &cp[last], other);
+}
+
+static void print_guess(const char *what, struct align_guess *g,
+			int agree, int sweeps)
+{
+	if (!g->size) {
+		report_printf("%s: unknown\n", what);
+		return;
+	}
+
+	report_printf("%s: %lld, confidence %.0f%% (step height against the rest), "
+		      "%d of %d sweeps agree, score %.1f\n",
+		      what, (long long)g->size, g->conf * 100, agree, sweeps,
+		      g->score);
+}
+
+static int try_read_alignments(struct device *dev, int tries, int blocksize,
+			       int sweeps)
 {
 	const int count = 7;
-	int ret;
+	int ret, i, n, s;
 	off_t align, maxalign;
+	struct align_guess erase, page, sweep_erase[sweeps], sweep_page[sweeps];
+	int erase_agree = 0, page_agree = 0;
 
 	/* make sure we can fit eight power-of-two blocks in the device */
 	for (maxalign = blocksize * 2; maxalign < dev->size / count; maxalign *= 2)
 		;
 
-	for (align = maxalign; align >= blocksize * 2; align /= 2) {
-		ret = try_read_alignment(dev, tries, count, maxalign, align, blocksize);
-		returnif (ret);
+	for (n = 0, align = maxalign; align >= blocksize * 2; align /= 2)
+		n++;
+
+	struct align_result res[sweeps][n], median[n];
+	ns_t col[sweeps];
+
+	for (s = 0; s < sweeps; s++) {
+		for (i = 0, align = maxalign; i < n; i++, align /= 2) {
+			ret = try_read_alignment(dev, tries, count, maxalign,
+						 align, blocksize, &res[s][i]);
+			returnif (ret);
+
+			if (!report_text() || sweeps == 1)
+				print_alignment(&res[s][i], s);
+		}
+
+		guess_alignment(res[s], n, &sweep_erase[s], &sweep_page[s]);
+	}
+
+	/* combine the sweeps using the median of each column */
+	for (i = 0; i < n; i++) {
+		median[i].align = res[0][i].align;
+#define MEDIAN(field) \
+		do { \
+			for (s = 0; s < sweeps; s++) \
+				col[s] = res[s][i].field; \
+			median[i].field = ns_median(sweeps, col); \
+		} while (0)
+		MEDIAN(pre);
+		MEDIAN(on);
+		MEDIAN(post);
+		MEDIAN(diff);
+#undef MEDIAN
+		if (report_text() && sweeps > 1)
+			print_alignment(&median[i], -1);
 	}
 
+	guess_alignment(median, n, &erase, &page);
+	for (s = 0; s < sweeps; s++) {
+		erase_agree += sweep_erase[s].size == erase.size;
+		page_agree += sweep_page[s].size == page.size;
+	}
+
+	if (report_text()) {
+		print_guess("erase block size", &erase, erase_agree, sweeps);
+		print_guess("page size", &page, page_agree, sweeps);
+		return 0;
+	}
+
+	report_begin("align-guess");
+	report_num("sweeps", sweeps);
+	report_num("erase_block", erase.size);
+	report_float("erase_block_score", erase.score);
+	report_float("erase_block_conf", erase.conf);
+	report_float("erase_block_agree", (double)erase_agree / sweeps);
+	report_num("page", page.size);
+	report_float("page_score", page.score);
+	report_float("page_conf", page.conf);
+	report_float("page_agree", (double)page_agree / sweeps);
+	report_end();
+
 	return 0;
 }
 
@@ -466,8 +1366,29 @@ static int try_program(struct device *dev)
 	return 0;
 }
 
+static int try_program_file(struct device *dev, const char *filename,
+			    off_t erasesize, unsigned long long offset)
+{
+	struct operation *program;
+
+	program = load_program(filename);
+	if (!program)
+		return -EINVAL;
+
+	if (offset == -1ull)
+		offset = 0;
+
+	if (!call(program, dev, offset, erasesize, 0)) {
+		free_program(program);
+		return -EIO;
+	}
+
+	free_program(program);
+	return 0;
+}
+
 #if 0
-static int try_open_au_oob(struct device *dev, unsigned int erasesize,
+static int try_open_au_oob(struct device *dev, off_t erasesize,
 			unsigned int blocksize,
 			unsigned int count,
 			bool random)
@@ -508,7 +1429,7 @@ static int try_open_au_oob(struct device *dev, unsigned int erasesize,
 }
 #endif
 
-static int try_open_au(struct device *dev, unsigned int erasesize,
+static int try_open_au(struct device *dev, off_t erasesize,
 			unsigned int blocksize,
 			unsigned int count,
 			unsigned long long offset,
@@ -548,15 +1469,157 @@ static int try_open_au(struct device *dev, unsigned int erasesize,
 	return 0;
 }
 
-static int try_find_fat(struct device *dev, unsigned int erasesize,
-				unsigned int blocksize,
-				unsigned int count,
-				bool random)
+/*
+ * Write throughput at the given block size while cycling through
+ * count erase blocks, as in the smallest block size of try_open_au.
+ */
+static int open_au_bps(struct device *dev, off_t erasesize,
+			unsigned int blocksize, unsigned int count,
+			unsigned long long offset, bool random, long long *bps)
 {
-	/* Find FAT Units */
 	struct operation program[] = {
-            /* loop through power of two multiple of one sector */
-            {O_LEN_POW2, find_order(erasesize, blocksize), - (long long)blocksize},
+		{O_LEN_FIXED, .val = blocksize},
+		{O_OFF_FIXED, .val = offset},
+		{O_BPS},
+		{O_REDUCE, .aggregate = A_AVERAGE},
+		{random ? O_OFF_RAND : O_OFF_LIN, erasesize / blocksize, -1},
+		{O_REDUCE, .aggregate = A_AVERAGE},
+		{O_OFF_RAND, count, 12 * erasesize},
+		{O_WRITE_RAND},
+		{O_END},
+	};
+
+	if (!call(program, dev, 0, erasesize, 0))
+		return -EIO;
+
+	if (program[0].r_type != R_BPS)
+		return -EINVAL;
+
+	*bps = program[0].result.l;
+	return 0;
+}
+
+/* one step of the search, base is the speed with one AU or zero */
+static int open_au_probe(struct device *dev, off_t erasesize,
+			 unsigned int blocksize, unsigned int count,
+			 unsigned long long offset, bool random,
+			 long long base, long long *bps)
+{
+	bool fast;
+	int ret;
+
+	ret = open_au_bps(dev, erasesize, blocksize, count, offset, random, bps);
+	returnif(ret);
+
+	/* anything less than half the speed of a single AU is a collapse */
+	fast = !base || *bps * 2 >= base;
+
+	if (!report_text()) {
+		report_begin("open-au-auto");
+		report_str("mode", random ? "random" : "linear");
+		report_num("open_au", count);
+		report_num("bps", *bps);
+		report_num("fast", fast);
+		report_end();
+	} else {
+		report_printf("%s\t%u open AUs\t%.2f MB/s%s\n",
+			random ? "random" : "linear", count, *bps / 1000000.0,
+			fast ? "" : "\tslow");
+	}
+
+	return fast;
+}
+
+/*
+ * Find the largest number of open erase blocks that can be written
+ * without a collapse in throughput, by doubling the number until
+ * it gets slow and then bisecting between the last fast and the
+ * first slow count. This needs only a logarithmic number of runs.
+ */
+static int try_open_au_search(struct device *dev, off_t erasesize,
+			      unsigned int blocksize, unsigned long long offset,
+			      bool random, unsigned int *result)
+{
+	unsigned int lo = 1, hi = 0, mid, limit;
+	long long base, bps;
+	int ret;
+
+	if (offset == -1ull)
+		offset = (1024 * 1024 * 16 + erasesize - 1) / erasesize * erasesize;
+
+	/* each AU is 12 erase blocks from the previous one */
+	if (dev->size <= (off_t)(offset + 12ull * erasesize))
+		return -EINVAL;
+	limit = (dev->size - offset) / (12ull * erasesize);
+
+	ret = open_au_probe(dev, erasesize, blocksize, 1, offset, random,
+			    0, &base);
+	returnif(ret);
+
+	for (mid = 2; mid <= limit; mid *= 2) {
+		ret = open_au_probe(dev, erasesize, blocksize, mid, offset,
+				    random, base, &bps);
+		returnif(ret);
+		if (!ret) {
+			hi = mid;
+			break;
+		}
+		lo = mid;
+	}
+
+	if (!hi)
+		hi = limit + 1;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		ret = open_au_probe(dev, erasesize, blocksize, mid, offset,
+				    random, base, &bps);
+		returnif(ret);
+		if (ret)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*result = lo;
+	return 0;
+}
+
+static int try_open_au_auto(struct device *dev, off_t erasesize,
+			    unsigned int blocksize, unsigned long long offset)
+{
+	unsigned int linear, random;
+	int ret;
+
+	ret = try_open_au_search(dev, erasesize, blocksize, offset, false,
+				 &linear);
+	returnif(ret);
+
+	ret = try_open_au_search(dev, erasesize, blocksize, offset, true,
+				 &random);
+	returnif(ret);
+
+	if (!report_text()) {
+		report_begin("open-au-result");
+		report_num("linear", linear);
+		report_num("random", random);
+		report_end();
+	} else {
+		report_printf("open AUs: %u linear, %u random\n", linear, random);
+	}
+
+	return 0;
+}
+
+static int try_find_fat(struct device *dev, off_t erasesize,
+				unsigned int blocksize,
+				unsigned int count,
+				bool random)
+{
+	/* Find FAT Units */
+	struct operation program[] = {
+            /* loop through power of two multiple of one sector */
+            {O_LEN_POW2, find_order(erasesize, blocksize), - (long long)blocksize},
             {O_SEQUENCE, 3},
                 /* print block size */
                 {O_DROP},
@@ -584,62 +1647,170 @@ static int try_find_fat(struct device *dev, unsigned int erasesize,
 
 static void print_help(const char *name)
 {
-	printf("%s [OPTION]... [DEVICE]\n", name);
-	printf("run tests on DEVICE, pointing to a flash storage medium.\n\n");
+	printf("%s [OPTION]... DEVICE...\n", name);
+	printf("run tests on each DEVICE, pointing to a flash storage medium.\n");
+	printf("several devices are tested at the same time.\n\n");
 	printf("-o, --out=FILE		write output to FILE instead of stdout\n");
+	printf("    --format=FMT	write results as text, json or csv (default:text)\n");
 	printf("-s, --scatter		run scatter read test\n");
 	printf("    --scatter-order=N 	scatter across 2^N blocks (default:9)\n");
 	printf("    --scatter-span=N 	span each write across N blocks (default:1)\n");
+	printf("-a, --align		guess erase block and page size\n");
+	printf("    --align-sweeps=N	repeat the alignment test N times (default:3)\n");
 	printf("-f, --find-fat		analyse first few erase blocks\n");
 	printf("    --fat-nr=N		look through first N erase blocks (default:6)\n");
 	printf("-O, --open-au		find number of open erase blocks\n");
 	printf("    --open-au-nr=N 	try N open erase blocks (default:2)\n");
+	printf("    --open-au-auto	search for the number of open erase blocks\n");
 	printf("    --offset=N  	start at position N\n");
 	printf("-r, --random		use pseudorandom access with erase block\n");
+	printf("    --seed=N		order of all pseudorandom accesses\n");
+	printf("    --program=FILE	run the VM program in FILE ('-' for stdin)\n");
 	printf("-v, --verbose		increase verbosity of output\n");
 	printf("-c, --count=N		run each test N times (default:8)\n");
+	printf("    --adaptive=PCT	sample until the median is known within PCT%%\n");
+	printf("    --budget=MS 	with --adaptive, spend at most MS ms per point\n");
 	printf("-b, --blocksize=N 	use a blocksize of N (default:16K)\n");
 	printf("-e, --erasesize=N 	use a eraseblock size of N (default:4M)\n");
+	printf("    --engine=NAME	do I/O through engine NAME: %s\n", dev_engines());
+	printf("-m, --mixed		mixed read/write workload\n");
+	printf("    --mix-read=PCT	percentage of reads (default:70)\n");
+	printf("    --mix-bs=LIST	block sizes and weights, e.g. 4K:80,64K:20 (default:blocksize)\n");
+	printf("    --mix-dist=DIST	uniform|seq|zipf[:THETA]|hotcold[:HOT:SHARE] (default:uniform)\n");
+	printf("    --mix-ops=N		number of requests (default:4096)\n");
+	printf("    --sustained		write across the span, find where the write cache fills\n");
+	printf("    --sustained-span=N	write N bytes (default:rest of the device)\n");
+	printf("    --sustained-window=N	measure throughput every N bytes (default:span/128)\n");
+	printf("    --replay=FILE	do the requests of a trace, text or from --trace\n");
+	printf("    --replay-timed	keep the times of the trace instead of going full speed\n");
+	printf("    --qd=N		keep N requests in flight (default:1)\n");
+	printf("    --qd-sweep		random read/write scaling from queue depth 1 up\n");
+	printf("    --qd-max=N		end queue depth sweep at N (default:256)\n");
+	printf("    --compress=PCT	make random write data PCT%% compressible (default:0)\n");
+	printf("    --cpu=LIST		run on the CPUs in LIST, one per device (default:isolated)\n");
+	printf("    --irq-aware		avoid CPUs handling interrupts of the device\n");
+	printf("    --mlock		lock and fault in all memory before the tests\n");
+	printf("    --trace=FILE	record every I/O in FILE, see tracedump\n");
+	printf("    --trace-size=N	keep the last N records (default:%d)\n",
+	       TRACE_DEFAULT_RECORDS);
 }
 
 struct arguments {
-	const char *dev;
+	char **devs;
+	int nr_devs;
 	const char *out;
-	bool scatter, interval, program, fat, open_au, align;
+	const char *program_file;
+	const char *format;
+	const char *engine;
+	bool scatter, interval, program, fat, open_au, open_au_auto, align, qd_sweep;
+	bool mixed, sustained;
 	bool random;
 	int count;
 	int blocksize;
-	int erasesize;
+	long long erasesize;
 	unsigned long long offset;
 	int scatter_order;
 	int scatter_span;
 	int interval_order;
 	int fat_nr;
 	int open_au_nr;
+	int align_sweeps;
+	double adaptive;
+	double budget;
+	int qd;
+	int qd_max;
+	int compress;
+	const char *cpus;
+	bool irq_aware;
+	bool mlock;
+	int mix_read;
+	int mix_ops;
+	const char *mix_sizes;
+	const char *mix_dist;
+	unsigned long long sustained_span;
+	unsigned long long sustained_window;
+	const char *trace;
+	unsigned long long trace_records;
+	const char *replay;
+	bool replay_timed;
 };
 
+/* a number of bytes, with an optional K, M or G suffix */
+static int parse_size(const char *str, unsigned long long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 0);
+	if (errno || end == str || *str == '-')
+		return -EINVAL;
+
+	switch (toupper(*end)) {
+	case 'G':
+		*val *= 1024;
+		/* fall through */
+	case 'M':
+		*val *= 1024;
+		/* fall through */
+	case 'K':
+		*val *= 1024;
+		end++;
+		break;
+	}
+
+	return *end ? -EINVAL : 0;
+}
+
 static int parse_arguments(int argc, char **argv, struct arguments *args)
 {
 	static const struct option long_options[] = {
 		{ "out", 1, NULL, 'o' },
+		{ "format", 1, NULL, 'T' },
 		{ "scatter", 0, NULL, 's' },
 		{ "scatter-order", 1, NULL, 'S' },
 		{ "scatter-span", 1, NULL, '$' },
 		{ "align", 0, NULL, 'a' },
+		{ "align-sweeps", 1, NULL, 'A' },
 		{ "interval", 0, NULL, 'i' },
 		{ "interval-order", 1, NULL, 'I' },
 		{ "find-fat", 0, NULL, 'f' },
 		{ "fat-nr", 1, NULL, 'F' },
 		{ "open-au", 0, NULL, 'O' },
 		{ "open-au-nr", 1, NULL, '0' },
+		{ "open-au-auto", 0, NULL, 'U' },
 		{ "offset", 1, NULL, 't' },
 		{ "random", 0, NULL, 'r' },
+		{ "seed", 1, NULL, 'x' },
 		{ "verbose", 0, NULL, 'v' },
 		{ "count", 1, NULL, 'c' },
+		{ "adaptive", 1, NULL, 'd' },
+		{ "budget", 1, NULL, 'B' },
 		{ "blocksize", 1, NULL, 'b' },
 		{ "erasesize", 1, NULL, 'e' },
+		{ "program", 1, NULL, 'P' },
+		{ "engine", 1, NULL, 'E' },
+		{ "qd", 1, NULL, 'q' },
+		{ "qd-sweep", 0, NULL, 'Q' },
+		{ "qd-max", 1, NULL, 'M' },
+		{ "compress", 1, NULL, 'C' },
+		{ "cpu", 1, NULL, 'u' },
+		{ "irq-aware", 0, NULL, 'R' },
+		{ "mlock", 0, NULL, 'L' },
+		{ "mixed", 0, NULL, 'm' },
+		{ "mix-read", 1, NULL, 'W' },
+		{ "mix-bs", 1, NULL, 'z' },
+		{ "mix-dist", 1, NULL, 'D' },
+		{ "mix-ops", 1, NULL, 'N' },
+		{ "sustained", 0, NULL, 'Y' },
+		{ "sustained-span", 1, NULL, 'y' },
+		{ "sustained-window", 1, NULL, 'G' },
+		{ "trace", 1, NULL, 'K' },
+		{ "trace-size", 1, NULL, 'k' },
+		{ "replay", 1, NULL, 'J' },
+		{ "replay-timed", 0, NULL, 'j' },
 		{ NULL, 0, NULL, 0 },
 	};
+	int max_order;
 
 	memset(args, 0, sizeof(*args));
 	args->count = 8;
@@ -650,11 +1821,17 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 	args->erasesize = 4 * 1024 * 1024;
 	args->fat_nr = 6;
 	args->open_au_nr = 2;
+	args->align_sweeps = 3;
+	args->qd = 1;
+	args->mix_read = 70;
+	args->mix_ops = 4096;
+	args->qd_max = 256;
+	args->trace_records = TRACE_DEFAULT_RECORDS;
 
 	while (1) {
 		int c;
 
-		c = getopt_long(argc, argv, "o:siafF:Ovrc:b:e:p", long_options, &optind);
+		c = getopt_long(argc, argv, "o:siafF:Ovrc:b:e:pm", long_options, &optind);
 
 		if (c == -1)
 			break;
@@ -664,6 +1841,10 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 			args->out = optarg;
 			break;
 
+		case 'T':
+			args->format = optarg;
+			break;
+
 		case 's':
 			args->scatter = 1;
 			break;
@@ -680,6 +1861,10 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 			args->align = 1;
 			break;
 
+		case 'A':
+			args->align_sweeps = atoi(optarg);
+			break;
+
 		case 'i':
 			args->interval = 1;
 			break;
@@ -704,14 +1889,26 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 			args->open_au_nr = atoi(optarg);
 			break;
 
+		case 'U':
+			args->open_au_auto = 1;
+			break;
+
 		case 'r':
 			args->random = 1;
 			break;
 
+		case 'x':
+			perm_seed = strtoull(optarg, NULL, 0);
+			break;
+
 		case 'p':
 			args->program = 1;
 			break;
 
+		case 'P':
+			args->program_file = optarg;
+			break;
+
 		case 'v':
 			verbose++;
 			break;
@@ -720,18 +1917,114 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 			args->count = atoi(optarg);
 			break;
 
+		case 'd':
+			args->adaptive = strtod(optarg, NULL);
+			break;
+
+		case 'B':
+			args->budget = strtod(optarg, NULL);
+			break;
+
 		case 'b':
 			args->blocksize = atoi(optarg);
 			break;
 
 		case 'e':
-			args->erasesize = atoi(optarg);
+			args->erasesize = strtoll(optarg, NULL, 0);
 			break;
 
 		case 't':
 			args->offset = strtoull(optarg, NULL, 0);
 			break;
 
+		case 'E':
+			args->engine = optarg;
+			break;
+
+		case 'q':
+			args->qd = atoi(optarg);
+			break;
+
+		case 'Q':
+			args->qd_sweep = 1;
+			break;
+
+		case 'M':
+			args->qd_max = atoi(optarg);
+			break;
+
+		case 'C':
+			args->compress = atoi(optarg);
+			break;
+
+		case 'u':
+			args->cpus = optarg;
+			break;
+
+		case 'R':
+			args->irq_aware = true;
+			break;
+
+		case 'L':
+			args->mlock = true;
+			break;
+
+		case 'm':
+			args->mixed = true;
+			break;
+
+		case 'W':
+			args->mix_read = atoi(optarg);
+			break;
+
+		case 'z':
+			args->mix_sizes = optarg;
+			break;
+
+		case 'D':
+			args->mix_dist = optarg;
+			break;
+
+		case 'N':
+			args->mix_ops = atoi(optarg);
+			break;
+
+		case 'Y':
+			args->sustained = true;
+			break;
+
+		case 'y':
+			if (parse_size(optarg, &args->sustained_span)) {
+				fprintf(stderr, "%s: invalid --sustained-span '%s', need a number of bytes with optional K, M or G\n",
+					argv[0], optarg);
+				return -EINVAL;
+			}
+			break;
+
+		case 'G':
+			if (parse_size(optarg, &args->sustained_window)) {
+				fprintf(stderr, "%s: invalid --sustained-window '%s', need a number of bytes with optional K, M or G\n",
+					argv[0], optarg);
+				return -EINVAL;
+			}
+			break;
+
+		case 'K':
+			args->trace = optarg;
+			break;
+
+		case 'k':
+			args->trace_records = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'J':
+			args->replay = optarg;
+			break;
+
+		case 'j':
+			args->replay_timed = true;
+			break;
+
 		case '?':
 			print_help(argv[0]);
 			return -EINVAL;
@@ -739,27 +2032,98 @@ static int parse_arguments(int argc, char **argv, struct arguments *args)
 		}
 	}
 
-	if (optind != (argc - 1))  {
+	if (optind >= argc)  {
 		fprintf(stderr, "%s: invalid arguments\n", argv[0]);
 		return -EINVAL;
 	}
 
-	args->dev = argv[optind];
+	args->devs = argv + optind;
+	args->nr_devs = argc - optind;
 
 	if (!(args->scatter || args->interval || args->program ||
-	      args->fat || args->open_au || args->align)) {
+	      args->program_file || args->fat || args->open_au ||
+	      args->open_au_auto || args->mixed || args->sustained ||
+	      args->replay ||
+	      args->align || args->qd_sweep)) {
 		fprintf(stderr, "%s: need at least one action\n", argv[0]);
 		return -EINVAL;
 	}
 
-	if (args->scatter && (args->scatter_order > 16)) {
-		fprintf(stderr, "%s: scatter_order must be at most 16\n", argv[0]);
+	if (args->mix_read < 0 || args->mix_read > 100 || args->mix_ops < 1) {
+		fprintf(stderr, "%s: need a read percentage from 0 to 100 and at least one op\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->trace && !args->trace_records) {
+		fprintf(stderr, "%s: trace needs room for at least one record\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->qd < 1) {
+		fprintf(stderr, "%s: queue depth must be at least 1\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->adaptive < 0 || args->budget < 0) {
+		fprintf(stderr, "%s: adaptive target and budget cannot be negative\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->align_sweeps < 1) {
+		fprintf(stderr, "%s: need at least one alignment sweep\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->compress < 0 || args->compress > 100) {
+		fprintf(stderr, "%s: compress must be between 0 and 100\n", argv[0]);
+		return -EINVAL;
+	}
+
+	if (args->blocksize < 1 || args->erasesize < 1 ||
+	    args->erasesize / args->blocksize > UINT_MAX) {
+		fprintf(stderr, "%s: erasesize cannot be more than %u blocks\n",
+			argv[0], UINT_MAX);
+		return -EINVAL;
+	}
+
+	/*
+	 * try_scatter_io keeps a request for every block, and with
+	 * --adaptive a buffer of samples as well, so these are the
+	 * largest that stay below about 100 MB.
+	 */
+	max_order = args->adaptive > 0 ? 16 : 20;
+	if (args->scatter && (args->scatter_order < 0 ||
+			      args->scatter_order > max_order)) {
+		fprintf(stderr, "%s: scatter_order must be between 0 and %d%s\n",
+			argv[0], max_order, args->adaptive > 0 ? " with --adaptive" : "");
 		return -EINVAL;
 	}
 
 	return 0;
 }
 
+/* largest single I/O done by the selected tests */
+static size_t max_iosize(struct arguments *args)
+{
+	size_t size = 0;
+
+#define atleast(x) do { if ((size_t)(x) > size) size = (x); } while (0)
+	if (args->scatter)
+		atleast((size_t)args->scatter_span * args->blocksize);
+	if (args->align || args->qd_sweep || args->mixed || args->sustained)
+		atleast(args->blocksize);
+	if (args->interval && args->interval_order > 0)
+		atleast(512ul << (args->interval_order - 1));
+	if (args->fat || args->open_au || args->open_au_auto ||
+	    args->program_file)
+		atleast(args->erasesize);
+	if (args->program)
+		atleast(512ul << 12);
+#undef atleast
+
+	return size;
+}
+
 static FILE *open_output(const char *filename)
 {
 	if (!filename || !strcmp(filename, "-"))
@@ -768,31 +2132,115 @@ static FILE *open_output(const char *filename)
 	return fopen(filename, "w+");
 }
 
-int main(int argc, char **argv)
-{
+/* one device, and the thread that runs all tests on it */
+struct worker {
+	struct arguments *args;
+	const char *name;
+	FILE *output;		/* for the scatter plot */
+	int cpu;		/* -1 to run anywhere */
+	pthread_t thread;
+
+	/* human readable output, kept until all workers are done */
+	FILE *text;
+	char *text_buf;
+	size_t text_len;
+
 	struct device dev;
-	struct arguments args;
-	FILE *output;
+	long long ns;
 	int ret;
+};
 
-	returnif(parse_arguments(argc, argv, &args));
+/*
+ * Context switches and page faults during a test. Voluntary switches
+ * are expected while waiting for I/O, anything else means the results
+ * may be disturbed, which is always pointed out in text output.
+ */
+static void report_usage(const char *test, const struct env_usage *start)
+{
+	struct env_usage u;
+
+	env_usage_since(start, &u);
+
+	if (!report_text()) {
+		report_begin("usage");
+		report_str("action", test);
+		report_num("voluntary_cs", u.nvcsw);
+		report_num("involuntary_cs", u.nivcsw);
+		report_num("minor_faults", u.minflt);
+		report_num("major_faults", u.majflt);
+		report_end();
+		return;
+	}
 
-	returnif(setup_dev(&dev, args.dev));
+	if (verbose || u.nivcsw || u.majflt)
+		report_printf("%s: %ld context switches (%ld involuntary), "
+			      "%ld page faults (%ld major)%s\n", test,
+			      u.nvcsw + u.nivcsw, u.nivcsw, u.minflt + u.majflt,
+			      u.majflt, (u.nivcsw || u.majflt) ? ", noisy" : "");
+}
 
-	output = open_output(args.out);
-	if (!output) {
-		perror(args.out);
-		return -errno;
+static int run_tests(struct worker *w)
+{
+	struct arguments *args = w->args;
+	struct device *dev = &w->dev;
+	struct env_usage usage;
+	int ret;
+
+	/*
+	 * Pin the thread before it touches its buffers, so they get
+	 * allocated on its own NUMA node on first use.
+	 */
+	if (w->cpu >= 0) {
+		ret = env_pin(w->cpu);
+		if (ret)
+			fprintf(stderr, "%s: cannot run on CPU %d: %s\n",
+				w->name, w->cpu, strerror(-ret));
+	}
+	set_rtprio();
+
+	returnif(setup_dev(dev, w->name, args->engine));
+
+	reserve_buffers(dev, max_iosize(args));
+
+	returnif(setup_compress(dev, args->compress));
+
+	if (args->mlock) {
+		ret = prefault_buffers(dev);
+		if (ret < 0) {
+			errno = -ret;
+			perror("prefault_buffers");
+			return ret;
+		}
 	}
 
+	ret = setup_qd(dev, args->qd);
+	if (ret < 0) {
+		errno = -ret;
+		perror("setup_qd");
+		return ret;
+	}
+
+	report_param_str("device", w->name);
+	report_param("blocksize", args->blocksize);
+	report_param("erasesize", args->erasesize);
+	report_param("count", args->count);
+	report_param("qd", args->qd);
+	report_param("compress", args->compress);
+
 	if (verbose > 1) {
-		printf("filename: \"%s\"\n", argv[1]);
-		printf("filesize: 0x%llx\n", (unsigned long long)dev.size);
+		report_printf("filename: \"%s\"\n", w->name);
+		report_printf("filesize: 0x%llx\n", (unsigned long long)dev->size);
+		report_printf("clock: %s, overhead %lldns\n", timing_source(),
+			timing_overhead);
+		report_printf("engine: %s\n", dev->ops->name);
+		report_printf("cpu: %d\n", sched_getcpu());
 	}
 
-	if (args.scatter) {
-		ret = try_scatter_io(&dev, args.count, args.scatter_order,
-				 args.scatter_span, args.blocksize, output);
+	if (args->scatter) {
+		env_usage(&usage);
+		ret = try_scatter_io(dev, args->count, args->scatter_order,
+				 args->scatter_span, args->blocksize, w->output);
+		report_usage("scatter", &usage);
 		if (ret < 0) {
 			errno = -ret;
 			perror("try_scatter_io");
@@ -800,17 +2248,22 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (args.fat) {
-		ret = try_find_fat(&dev, args.erasesize, args.blocksize,
-				   args.fat_nr, args.random);
+	if (args->fat) {
+		env_usage(&usage);
+		ret = try_find_fat(dev, args->erasesize, args->blocksize,
+				   args->fat_nr, args->random);
+		report_usage("find-fat", &usage);
 		if (ret < 0) {
 			errno = -ret;
 			perror("try_find_fat");
 		}
 	}
 
-	if (args.align) {
-		ret = try_read_alignments(&dev, args.count, args.blocksize);
+	if (args->align) {
+		env_usage(&usage);
+		ret = try_read_alignments(dev, args->count, args->blocksize,
+					  args->align_sweeps);
+		report_usage("align", &usage);
 		if (ret < 0) {
 			errno = -ret;
 			perror("try_read_alignments");
@@ -818,9 +2271,11 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (args.open_au) {
-		ret = try_open_au(&dev, args.erasesize, args.blocksize,
-				  args.open_au_nr, args.offset, args.random);
+	if (args->open_au) {
+		env_usage(&usage);
+		ret = try_open_au(dev, args->erasesize, args->blocksize,
+				  args->open_au_nr, args->offset, args->random);
+		report_usage("open-au", &usage);
 		if (ret < 0) {
 			errno = -ret;
 			perror("try_open_au");
@@ -828,8 +2283,22 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (args.interval) {
-		ret = try_intervals(&dev, args.count, args.interval_order);
+	if (args->open_au_auto) {
+		env_usage(&usage);
+		ret = try_open_au_auto(dev, args->erasesize, args->blocksize,
+				       args->offset);
+		report_usage("open-au-auto", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_open_au_auto");
+			return ret;
+		}
+	}
+
+	if (args->interval) {
+		env_usage(&usage);
+		ret = try_intervals(dev, args->count, args->interval_order);
+		report_usage("interval", &usage);
 		if (ret < 0) {
 			errno = -ret;
 			perror("try_intervals");
@@ -837,9 +2306,253 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (args.program) {
-		try_program(&dev);
+	if (args->qd_sweep) {
+		env_usage(&usage);
+		ret = try_qd_sweep(dev, args->count, args->qd_max,
+				   args->blocksize, args->offset);
+		report_usage("qd-sweep", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_qd_sweep");
+			return ret;
+		}
+	}
+
+	if (args->mixed) {
+		env_usage(&usage);
+		ret = try_mixed(dev, args->mix_ops, args->mix_read,
+				args->mix_sizes, args->blocksize,
+				args->mix_dist, args->offset);
+		report_usage("mixed", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_mixed");
+			return ret;
+		}
+	}
+
+	if (args->replay) {
+		env_usage(&usage);
+		ret = try_replay(dev, args->replay, args->replay_timed);
+		report_usage("replay", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_replay");
+			return ret;
+		}
+	}
+
+	if (args->sustained) {
+		env_usage(&usage);
+		ret = try_sustained(dev, args->sustained_span,
+				    args->sustained_window, args->blocksize,
+				    args->offset, args->random);
+		report_usage("sustained", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_sustained");
+			return ret;
+		}
+	}
+
+	if (args->program) {
+		env_usage(&usage);
+		try_program(dev);
+		report_usage("builtin-program", &usage);
+	}
+
+	if (args->program_file) {
+		env_usage(&usage);
+		ret = try_program_file(dev, args->program_file, args->erasesize,
+				       args->offset);
+		report_usage("program", &usage);
+		if (ret < 0) {
+			errno = -ret;
+			perror("try_program_file");
+			return ret;
+		}
 	}
 
 	return 0;
 }
+
+static long long wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	long long start;
+
+	report_text_stream(w->text);
+
+	start = wall_ns();
+	w->ret = run_tests(w);
+	w->ns = wall_ns() - start;
+
+	return NULL;
+}
+
+static void print_summary(FILE *out, struct worker *w, int nr)
+{
+	struct device *dev;
+	char buf[8];
+	int i;
+
+	if (report_text())
+		fprintf(out, "device\ttime\treads\twrites\terases\tread\twritten\tresult\n");
+
+	for (i = 0; i < nr; i++) {
+		dev = &w[i].dev;
+
+		if (!report_text()) {
+			report_begin("summary");
+			report_str("device", w[i].name);
+			report_num("ns", w[i].ns);
+			report_num("reads", dev->nr_io[IO_READ]);
+			report_num("writes", dev->nr_io[IO_WRITE]);
+			report_num("erases", dev->nr_io[IO_ERASE]);
+			report_num("read_bytes", dev->io_bytes[IO_READ]);
+			report_num("write_bytes", dev->io_bytes[IO_WRITE]);
+			report_num("result", w[i].ret);
+			report_end();
+			continue;
+		}
+
+		format_ns(buf, w[i].ns);
+		fprintf(out, "%s\t%s\t%llu\t%llu\t%llu\t%.1fM\t%.1fM\t%s\n",
+			w[i].name, buf, dev->nr_io[IO_READ],
+			dev->nr_io[IO_WRITE], dev->nr_io[IO_ERASE],
+			dev->io_bytes[IO_READ] / 1048576.0,
+			dev->io_bytes[IO_WRITE] / 1048576.0,
+			w[i].ret < 0 ? strerror(-w[i].ret) : "ok");
+	}
+}
+
+/*
+ * With more than one device, every device gets a worker thread of
+ * its own, pinned to its own CPU as far as there are enough, and
+ * all of them run the same tests at the same time. The output of
+ * each one is collected and written in one piece once all are done,
+ * followed by a summary of all devices.
+ */
+static int run_workers(struct arguments *args, FILE *output,
+		       const cpu_set_t *cpus)
+{
+	struct worker *w;
+	int i, err, ret = 0;
+
+	w = calloc(args->nr_devs, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	for (i = 0; i < args->nr_devs; i++) {
+		w[i].args = args;
+		w[i].name = args->devs[i];
+		w[i].cpu = env_pick_cpu(cpus, w[i].name, args->irq_aware, i);
+		w[i].text = open_memstream(&w[i].text_buf, &w[i].text_len);
+		if (!w[i].text) {
+			ret = -errno;
+			break;
+		}
+		w[i].output = report_text() ? w[i].text : output;
+
+		err = pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+		if (err) {
+			fclose(w[i].text);
+			free(w[i].text_buf);
+			ret = -err;
+			break;
+		}
+	}
+
+	/* the ones that did start still have to finish */
+	args->nr_devs = i;
+	for (i = 0; i < args->nr_devs; i++) {
+		pthread_join(w[i].thread, NULL);
+		fclose(w[i].text);
+
+		/* in a structured format, only messages end up here */
+		if (report_text())
+			fprintf(output, "== %s ==\n%s", w[i].name, w[i].text_buf);
+		else if (w[i].text_len)
+			fprintf(stderr, "== %s ==\n%s", w[i].name, w[i].text_buf);
+		free(w[i].text_buf);
+
+		if (w[i].ret < 0 && !ret)
+			ret = w[i].ret;
+	}
+
+	print_summary(output, w, args->nr_devs);
+
+	free(w);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct arguments args;
+	struct worker w = { .cpu = -1 };
+	cpu_set_t cpus;
+	FILE *output;
+	int ret, err;
+
+	returnif(parse_arguments(argc, argv, &args));
+
+	sample_policy.target = args.adaptive * 100;
+	sample_policy.budget = args.budget * 1000000;
+
+	output = open_output(args.out);
+	if (!output) {
+		perror(args.out);
+		return -errno;
+	}
+
+	if (report_setup(args.format, output)) {
+		fprintf(stderr, "%s: unknown format '%s'\n", argv[0], args.format);
+		return -EINVAL;
+	}
+
+	ret = env_cpus(args.cpus, &cpus);
+	if (ret < 0) {
+		fprintf(stderr, "%s: invalid CPU list '%s'\n", argv[0],
+			args.cpus ? args.cpus : "");
+		return ret;
+	}
+
+	/* before locking memory, so the ring gets locked as well */
+	if (args.trace) {
+		err = trace_open(args.trace, args.trace_records);
+		if (err) {
+			errno = -err;
+			perror(args.trace);
+			return err;
+		}
+	}
+
+	/* not fatal, but every test should say how many faults it got */
+	if (args.mlock && env_lock_memory() < 0)
+		perror("mlockall");
+
+	if (args.nr_devs > 1) {
+		ret = run_workers(&args, output, &cpus);
+	} else {
+		w.args = &args;
+		w.name = args.devs[0];
+		w.output = output;
+
+		/* a single device stays wherever it is started, unless asked */
+		if (ret || args.irq_aware)
+			w.cpu = env_pick_cpu(&cpus, w.name, args.irq_aware, 0);
+
+		ret = run_tests(&w);
+	}
+
+	trace_close();
+	return ret;
+}
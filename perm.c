@@ -0,0 +1,58 @@
+#include "perm.h"
+
+unsigned long long perm_seed = 0x666c617368ull;
+
+static unsigned long long mix64(unsigned long long z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+void perm_init(struct perm *p, unsigned long long n, unsigned long long seed)
+{
+	unsigned int bits = 0, i;
+
+	p->n = n;
+
+	/* smallest even number of bits that covers n, at least two */
+	while (bits < 64 && (n - 1) >> bits)
+		bits++;
+	p->half = bits < 2 ? 1 : (bits + 1) / 2;
+
+	for (i = 0; i < PERM_ROUNDS; i++)
+		p->key[i] = mix64(seed + 0x9e3779b97f4a7c15ull * (i + 1));
+}
+
+/* balanced Feistel network, a bijection on 2 * half bits */
+static unsigned long long feistel(const struct perm *p, unsigned long long x)
+{
+	unsigned long long mask = (1ull << p->half) - 1;
+	unsigned long long l = (x >> p->half) & mask, r = x & mask, t;
+	unsigned int i;
+
+	for (i = 0; i < PERM_ROUNDS; i++) {
+		t = r;
+		r = l ^ (mix64(r ^ p->key[i]) & mask);
+		l = t;
+	}
+
+	return (l << p->half) | r;
+}
+
+/*
+ * The Feistel domain is less than four times larger than n, so
+ * walking the cycle until the result is in range takes a few steps
+ * at most, and keeps the result a permutation of 0 .. n-1.
+ */
+unsigned long long perm_map(const struct perm *p, unsigned long long i)
+{
+	if (p->n <= 1)
+		return 0;
+
+	do {
+		i = feistel(p, i);
+	} while (i >= p->n);
+
+	return i;
+}
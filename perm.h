@@ -0,0 +1,24 @@
+#ifndef FLASHBENCH_PERM_H
+#define FLASHBENCH_PERM_H
+
+/*
+ * Pseudorandom permutation of 0 .. n-1 for any n up to 2^64-1, used to
+ * visit every block of a range exactly once in random order. The same
+ * seed always gives the same order.
+ */
+#define PERM_ROUNDS 4
+
+struct perm {
+	unsigned long long n;
+	unsigned int half;		/* bits in each half of a Feistel block */
+	unsigned long long key[PERM_ROUNDS];
+};
+
+/* default seed for all random access tests, set with --seed */
+extern unsigned long long perm_seed;
+
+extern void perm_init(struct perm *p, unsigned long long n,
+		      unsigned long long seed);
+extern unsigned long long perm_map(const struct perm *p, unsigned long long i);
+
+#endif /* FLASHBENCH_PERM_H */
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rand.h"
+
+/*
+ * Two interleaved xoshiro256+ generators, written with the GCC
+ * vector extensions so that the compiler can keep each of the four
+ * state words in one SIMD register and produce 16 bytes per step.
+ * 128-bit vectors are available on every x86-64 and arm64 CPU.
+ * This is not meant to be good random data for any statistical
+ * purpose, only to be impossible to compress or deduplicate, and
+ * fast enough to refill large write buffers.
+ */
+typedef unsigned long long u64x2 __attribute__((vector_size(16)));
+
+struct rng {
+	u64x2 s[4];
+};
+
+static unsigned long long splitmix64(unsigned long long *x)
+{
+	unsigned long long z = (*x += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+struct rng *rng_new(unsigned long long seed)
+{
+	struct rng *rng;
+	int i, j;
+
+	if (posix_memalign((void **)&rng, 16, sizeof(*rng)))
+		return NULL;
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 2; j++)
+			rng->s[i][j] = splitmix64(&seed);
+
+	return rng;
+}
+
+static inline u64x2 rotl(u64x2 x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline u64x2 rng_next(struct rng *rng)
+{
+	u64x2 *s = rng->s;
+	u64x2 result = s[0] + s[3];
+	u64x2 t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+static void fill_random(struct rng *rng, char *p, size_t size)
+{
+	u64x2 v;
+
+	for (; size >= sizeof(v); size -= sizeof(v), p += sizeof(v)) {
+		v = rng_next(rng);
+		memcpy(p, &v, sizeof(v));
+	}
+
+	if (size) {
+		v = rng_next(rng);
+		memcpy(p, &v, size);
+	}
+}
+
+void rng_fill(struct rng *rng, void *buf, size_t size, unsigned int compress)
+{
+	const size_t block = 4096;
+	size_t random, len;
+	char *p = buf;
+
+	if (!compress) {
+		fill_random(rng, p, size);
+		return;
+	}
+
+	random = block * (100 - (compress > 100 ? 100 : compress)) / 100;
+	for (; size; size -= len, p += len) {
+		len = size < block ? size : block;
+		if (random >= len) {
+			fill_random(rng, p, len);
+		} else {
+			fill_random(rng, p, random);
+			memset(p + random, 0, len - random);
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef FLASHBENCH_RAND_H
+#define FLASHBENCH_RAND_H
+
+#include <stddef.h>
+
+struct rng;
+
+extern struct rng *rng_new(unsigned long long seed);
+
+/*
+ * Fill buf with pseudorandom data. With compress set to a percentage,
+ * that part of every 4 KiB block is zero, so a compressing controller
+ * can shrink the data by about that much.
+ */
+extern void rng_fill(struct rng *rng, void *buf, size_t size,
+		     unsigned int compress);
+
+#endif /* FLASHBENCH_RAND_H */
@@ -0,0 +1,248 @@
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "report.h"
+
+#define REPORT_FIELDS	32
+#define REPORT_PARAMS	16
+#define REPORT_VALLEN	256
+
+struct field {
+	const char *key;
+	char val[REPORT_VALLEN];
+	bool string;
+};
+
+enum report_format report_format = REPORT_TEXT;
+static FILE *report_out;
+
+/*
+ * Each thread builds its own records, and only takes the lock on
+ * report_out to write a complete one.
+ */
+static __thread struct field params[REPORT_PARAMS];
+static __thread unsigned int nr_params;
+
+static __thread struct field fields[REPORT_FIELDS];
+static __thread unsigned int nr_fields;
+
+/* human readable output of this thread, see report_printf if not set */
+static __thread FILE *text_out;
+
+/* CSV header of the last record, to know when to print a new one */
+static char header[REPORT_FIELDS * 32];
+
+int report_setup(const char *format, FILE *out)
+{
+	report_out = out;
+
+	if (!format || !strcmp(format, "text"))
+		report_format = REPORT_TEXT;
+	else if (!strcmp(format, "json"))
+		report_format = REPORT_JSON;
+	else if (!strcmp(format, "csv"))
+		report_format = REPORT_CSV;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+void report_text_stream(FILE *out)
+{
+	text_out = out;
+}
+
+int report_printf(const char *fmt, ...)
+{
+	FILE *out = text_out;
+	va_list ap;
+	int ret;
+
+	if (!out)
+		out = report_text() ? stdout : stderr;
+
+	va_start(ap, fmt);
+	ret = vfprintf(out, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+static struct field *param_slot(const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_params; i++)
+		if (!strcmp(params[i].key, key))
+			return &params[i];
+
+	if (nr_params == REPORT_PARAMS)
+		return NULL;
+
+	params[nr_params].key = key;
+	return &params[nr_params++];
+}
+
+void report_param(const char *key, long long val)
+{
+	struct field *f = param_slot(key);
+
+	if (!f)
+		return;
+	snprintf(f->val, sizeof(f->val), "%lld", val);
+	f->string = false;
+}
+
+void report_param_str(const char *key, const char *val)
+{
+	struct field *f = param_slot(key);
+
+	if (!f)
+		return;
+	snprintf(f->val, sizeof(f->val), "%s", val);
+	f->string = true;
+}
+
+static struct field *add_field(const char *key, bool string)
+{
+	struct field *f;
+
+	if (nr_fields == REPORT_FIELDS)
+		return NULL;
+
+	f = &fields[nr_fields++];
+	f->key = key;
+	f->string = string;
+	return f;
+}
+
+void report_begin(const char *test)
+{
+	unsigned int i;
+
+	nr_fields = 0;
+	report_str("test", test);
+	for (i = 0; i < nr_params; i++)
+		fields[nr_fields++] = params[i];
+}
+
+void report_num(const char *key, long long val)
+{
+	struct field *f = add_field(key, false);
+
+	if (f)
+		snprintf(f->val, sizeof(f->val), "%lld", val);
+}
+
+void report_float(const char *key, double val)
+{
+	struct field *f = add_field(key, false);
+
+	/* left empty, and null in JSON, if there is no valid result */
+	if (f && isfinite(val))
+		snprintf(f->val, sizeof(f->val), "%.9g", val);
+	else if (f)
+		f->val[0] = '\0';
+}
+
+void report_str(const char *key, const char *val)
+{
+	struct field *f = add_field(key, true);
+
+	if (f)
+		snprintf(f->val, sizeof(f->val), "%s", val);
+}
+
+static void put_json_string(const char *s)
+{
+	fputc('"', report_out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(report_out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(report_out, "\\u%04x", *s);
+		else
+			fputc(*s, report_out);
+	}
+	fputc('"', report_out);
+}
+
+static void put_csv_string(const char *s)
+{
+	if (!strpbrk(s, ",\"\n")) {
+		fputs(s, report_out);
+		return;
+	}
+
+	fputc('"', report_out);
+	for (; *s; s++) {
+		if (*s == '"')
+			fputc('"', report_out);
+		fputc(*s, report_out);
+	}
+	fputc('"', report_out);
+}
+
+static void end_json(void)
+{
+	unsigned int i;
+
+	fputc('{', report_out);
+	for (i = 0; i < nr_fields; i++) {
+		if (i)
+			fputc(',', report_out);
+		put_json_string(fields[i].key);
+		fputc(':', report_out);
+		if (fields[i].string)
+			put_json_string(fields[i].val);
+		else if (!fields[i].val[0])
+			fputs("null", report_out);
+		else
+			fputs(fields[i].val, report_out);
+	}
+	fputs("}\n", report_out);
+}
+
+static void end_csv(void)
+{
+	char keys[sizeof(header)] = "";
+	unsigned int i;
+	size_t pos = 0;
+
+	for (i = 0; i < nr_fields && pos < sizeof(keys); i++)
+		pos += snprintf(keys + pos, sizeof(keys) - pos, "%s%s",
+				i ? "," : "", fields[i].key);
+
+	if (strcmp(keys, header)) {
+		strcpy(header, keys);
+		fprintf(report_out, "%s\n", header);
+	}
+
+	for (i = 0; i < nr_fields; i++) {
+		if (i)
+			fputc(',', report_out);
+		put_csv_string(fields[i].val);
+	}
+	fputc('\n', report_out);
+}
+
+void report_end(void)
+{
+	if (report_format == REPORT_TEXT) {
+		nr_fields = 0;
+		return;
+	}
+
+	flockfile(report_out);
+	if (report_format == REPORT_JSON)
+		end_json();
+	else
+		end_csv();
+	funlockfile(report_out);
+
+	nr_fields = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef FLASHBENCH_REPORT_H
+#define FLASHBENCH_REPORT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Machine readable output
+ *
+ * With a structured format selected, each test writes its results
+ * as flat records of named fields at full precision instead of the
+ * human readable tables. A record starts with the test name and the
+ * parameters set with report_param, followed by the fields of the
+ * test itself. JSON output has one object per line, CSV output
+ * repeats the header line whenever the set of fields changes.
+ */
+enum report_format {
+	REPORT_TEXT,
+	REPORT_JSON,
+	REPORT_CSV,
+};
+
+extern enum report_format report_format;
+
+static inline bool report_text(void)
+{
+	return report_format == REPORT_TEXT;
+}
+
+extern int report_setup(const char *format, FILE *out);
+
+/*
+ * Human readable output goes through report_printf, to the stream
+ * set for the calling thread, so that tests running on several
+ * devices at once each keep their own, or else to stdout. With a
+ * structured format, it only carries messages, which go to stderr
+ * instead, so that nothing but records ends up on stdout.
+ */
+extern void report_text_stream(FILE *out);
+extern int report_printf(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/* parameters attached to every following record */
+extern void report_param(const char *key, long long val);
+extern void report_param_str(const char *key, const char *val);
+
+extern void report_begin(const char *test);
+extern void report_num(const char *key, long long val);
+extern void report_float(const char *key, double val);
+extern void report_str(const char *key, const char *val);
+extern void report_end(void);
+
+#endif /* FLASHBENCH_REPORT_H */
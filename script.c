@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "vm.h"
+
+/*
+ * Text form of VM programs
+ *
+ * Each line holds one operation: the opcode name from syntax[],
+ * followed by its arguments. Numbers fill in .num and then .val,
+ * in that order, for whichever of the two the opcode takes, and
+ * may carry a K, M or G suffix. A quoted string is the .string of
+ * PRINT, and a bare word names the aggregate of REDUCE. Anything
+ * after a '#' is a comment, and indentation is ignored.
+ */
+
+static const char *aggregates[] = {
+	[A_MINIMUM]	= "MINIMUM",
+	[A_MAXIMUM]	= "MAXIMUM",
+	[A_AVERAGE]	= "AVERAGE",
+	[A_TOTAL]	= "TOTAL",
+	[A_IGNORE]	= "IGNORE",
+	[A_PERCENTILE]	= "PERCENTILE",
+	[A_HISTOGRAM]	= "HISTOGRAM",
+};
+
+static int find_aggregate(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(aggregates) / sizeof(aggregates[0]); i++)
+		if (aggregates[i] && !strcasecmp(aggregates[i], name))
+			return i;
+
+	return -1;
+}
+
+static int parse_number(const char *s, long long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoll(s, &end, 0);
+	if (errno || end == s)
+		return -EINVAL;
+
+	switch (toupper(*end)) {
+	case 'G':
+		*val *= 1024;
+		/* fall through */
+	case 'M':
+		*val *= 1024;
+		/* fall through */
+	case 'K':
+		*val *= 1024;
+		end++;
+		break;
+	}
+
+	return *end ? -EINVAL : 0;
+}
+
+/* unquote a string in place, handling the usual C escapes */
+static char *parse_string(char **p)
+{
+	char *start = *p + 1, *in = start, *out = start;
+
+	while (*in && *in != '"') {
+		if (*in == '\\' && in[1]) {
+			in++;
+			switch (*in) {
+			case 'n': *out++ = '\n'; break;
+			case 't': *out++ = '\t'; break;
+			default:  *out++ = *in;  break;
+			}
+			in++;
+		} else {
+			*out++ = *in++;
+		}
+	}
+
+	if (*in != '"')
+		return NULL;
+
+	*p = in + 1;
+	*out = '\0';
+	return strdup(start);
+}
+
+static int parse_line(char *line, struct operation *op,
+		      const char *filename, int lineno)
+{
+	char *p = line, *word;
+	enum param param;
+	int code, numbers = 0;
+	long long val;
+
+	memset(op, 0, sizeof(*op));
+
+	while (isspace(*p))
+		p++;
+	word = p;
+	while (*p && !isspace(*p))
+		p++;
+	if (*p)
+		*p++ = '\0';
+
+	code = vm_opcode(word);
+	if (code < 0) {
+		report_printf("%s:%d: unknown operation '%s'\n", filename, lineno, word);
+		return -EINVAL;
+	}
+	param = vm_params(code);
+
+	op->code = code;
+
+	while (1) {
+		while (isspace(*p))
+			p++;
+		if (!*p || *p == '#')
+			break;
+
+		if (*p == '"') {
+			if (op->string || !(param & P_STRING))
+				goto unexpected;
+			op->string = parse_string(&p);
+			if (!op->string) {
+				report_printf("%s:%d: unterminated string\n",
+					filename, lineno);
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		word = p;
+		while (*p && !isspace(*p))
+			p++;
+		if (*p)
+			*p++ = '\0';
+
+		if (isalpha(*word)) {
+			int aggregate = find_aggregate(word);
+
+			if (aggregate < 0 || op->aggregate ||
+			    !(param & P_AGGREGATE))
+				goto unexpected;
+			op->aggregate = aggregate;
+			continue;
+		}
+
+		if (parse_number(word, &val)) {
+			report_printf("%s:%d: invalid number '%s'\n", filename,
+				lineno, word);
+			return -EINVAL;
+		}
+
+		if ((param & P_NUM) && numbers == 0) {
+			if (val <= 0 || val > 0xffffffffll) {
+				report_printf("%s:%d: count %lld out of range\n",
+					filename, lineno, val);
+				return -EINVAL;
+			}
+			op->num = val;
+		} else if ((param & (P_VAL | P_OPTVAL)) &&
+			   numbers == !!(param & P_NUM)) {
+			op->val = val;
+		} else {
+			goto unexpected;
+		}
+		numbers++;
+	}
+
+	return 0;
+
+unexpected:
+	report_printf("%s:%d: unexpected argument '%s' for %s\n", filename, lineno,
+		word, vm_opname(code));
+	return -EINVAL;
+}
+
+struct operation *load_program(const char *filename)
+{
+	struct operation *program = NULL, *p;
+	unsigned int count = 0, size = 0;
+	char *line = NULL, *s;
+	size_t linesize = 0;
+	int lineno = 0, ret = 0;
+	FILE *f;
+
+	if (!strcmp(filename, "-"))
+		f = stdin;
+	else
+		f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return NULL;
+	}
+
+	while (getline(&line, &linesize, f) >= 0) {
+		lineno++;
+
+		for (s = line; isspace(*s); s++)
+			;
+		if (!*s || *s == '#')
+			continue;
+
+		/* always leave room for the END guard */
+		if (count + 1 >= size) {
+			size = size ? size * 2 : 64;
+			p = realloc(program, size * sizeof(*program));
+			if (!p) {
+				ret = -ENOMEM;
+				break;
+			}
+			program = p;
+		}
+
+		ret = parse_line(s, &program[count], filename, lineno);
+		if (ret) {
+			free((char *)program[count].string);
+			break;
+		}
+		count++;
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	if (!ret && !count) {
+		report_printf("%s: empty program\n", filename);
+		ret = -EINVAL;
+	}
+
+	if (!ret) {
+		memset(&program[count], 0, sizeof(*program));
+		ret = vm_check(program, count);
+	}
+
+	if (ret) {
+		while (count--)
+			free((char *)program[count].string);
+		free(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+void free_program(struct operation *program)
+{
+	unsigned int i, count = vm_size(program);
+
+	for (i = 0; i < count; i++)
+		free((char *)program[i].string);
+	free(program);
+}
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dev.h"
+
+/*
+ * Simulated flash card
+ *
+ * The data goes to the backing file, but the time each access takes
+ * comes from a simple model of the flash translation layer found on
+ * typical SD cards, on a virtual clock, so every run gives the same
+ * results. The model has
+ *
+ * - reads that take longer for each page they touch, and longer
+ *   still when crossing into another erase block,
+ * - a limited number of open erase blocks; writing to another one
+ *   first closes the least recently used, which copies all its
+ *   unwritten pages and erases a block,
+ * - writes within an open erase block that do not continue where
+ *   the last one ended, which cost an extra copy per page,
+ * - a read-modify-write cycle for partial pages,
+ * - a FAT area at the start with small pages that can be written
+ *   in any order, and never counts against the open erase blocks.
+ *
+ * All parameters can be given as options, e.g.
+ * --engine=sim:erase=4M,page=16K,open=2,fat=1
+ */
+struct open_au {
+	unsigned long long au;
+	unsigned int written;	/* pages */
+	unsigned int next;	/* page following the last write */
+	unsigned char *map;	/* page has been written since opening */
+};
+
+struct sim {
+	unsigned long long erase, page;
+	unsigned int open_max, fat;
+	long long bw;		/* MB/s on the bus */
+	long long t_cmd, t_read, t_cross, t_prog, t_copy, t_erase;
+
+	long long now;
+
+	/* most recently used first */
+	struct open_au *open;
+	unsigned int nr_open;
+};
+
+#define FAT_PAGE 4096
+
+static const struct sim sim_defaults = {
+	.erase = 4 * 1024 * 1024,
+	.page = 16 * 1024,
+	.open_max = 2,
+	.fat = 1,
+	.bw = 20,
+	.t_cmd = 20000,
+	.t_read = 30000,
+	.t_cross = 100000,
+	.t_prog = 200000,
+	.t_copy = 250000,
+	.t_erase = 2000000,
+};
+
+static long long sim_now(struct device *dev)
+{
+	struct sim *s = dev->priv;
+
+	return s->now;
+}
+
+static long long xfer_ns(struct sim *s, size_t size)
+{
+	return (long long)size * 1000 / s->bw;
+}
+
+static unsigned int pages_per_au(struct sim *s)
+{
+	return s->erase / s->page;
+}
+
+/* close an erase block, filling it up with the old contents */
+static long long close_au(struct sim *s, unsigned int i)
+{
+	long long cost;
+
+	cost = (long long)(pages_per_au(s) - s->open[i].written) * s->t_copy +
+		s->t_erase;
+
+	free(s->open[i].map);
+	memmove(&s->open[i], &s->open[i + 1],
+		(s->nr_open - i - 1) * sizeof(s->open[0]));
+	s->nr_open--;
+
+	return cost;
+}
+
+/* find or open an erase block and make it the most recently used */
+static struct open_au *get_au(struct sim *s, unsigned long long au,
+			      long long *cost)
+{
+	struct open_au o;
+	unsigned int i;
+
+	for (i = 0; i < s->nr_open; i++)
+		if (s->open[i].au == au)
+			break;
+
+	if (i < s->nr_open) {
+		o = s->open[i];
+	} else {
+		if (s->nr_open == s->open_max)
+			*cost += close_au(s, s->nr_open - 1);
+
+		o.au = au;
+		o.written = 0;
+		o.next = 0;
+		o.map = calloc(pages_per_au(s), 1);
+		if (!o.map)
+			return NULL;
+		i = s->nr_open++;
+	}
+
+	memmove(&s->open[1], &s->open[0], i * sizeof(s->open[0]));
+	s->open[0] = o;
+
+	return &s->open[0];
+}
+
+static int sim_write_au(struct sim *s, unsigned long long au,
+			unsigned long long start, unsigned long long end,
+			long long *cost)
+{
+	unsigned long long page, first, last;
+	struct open_au *o;
+
+	if (au < s->fat) {
+		*cost += (end - start + FAT_PAGE - 1) / FAT_PAGE * s->t_prog / 4;
+		return 0;
+	}
+
+	o = get_au(s, au, cost);
+	if (!o)
+		return -ENOMEM;
+
+	first = start / s->page;
+	last = (end - 1) / s->page;
+
+	/* out of order, the pages have to be remapped */
+	if (first != o->next && !(first + 1 == o->next && start % s->page))
+		*cost += (last - first + 1) * s->t_copy;
+	o->next = end % s->page ? last : last + 1;
+
+	for (page = first; page <= last; page++) {
+		if (!o->map[page]) {
+			/* partial page, the rest has to be read first */
+			if (start > page * s->page ||
+			    end < (page + 1) * s->page)
+				*cost += s->t_read;
+			o->map[page] = 1;
+			o->written++;
+		}
+		*cost += s->t_prog;
+	}
+
+	/* a full block needs nothing when it gets closed */
+	if (o->written == pages_per_au(s)) {
+		free(o->map);
+		memmove(&s->open[0], &s->open[1],
+			(s->nr_open - 1) * sizeof(s->open[0]));
+		s->nr_open--;
+	}
+
+	return 0;
+}
+
+static ssize_t sim_write(struct device *dev, const void *buf, size_t size,
+			 off_t pos)
+{
+	struct sim *s = dev->priv;
+	unsigned long long au, start, end, stop = pos + size;
+	long long cost = s->t_cmd + xfer_ns(s, size);
+	ssize_t ret;
+	int err;
+
+	ret = pwrite(dev->fd, buf, size, pos);
+	if (ret <= 0)
+		return ret;
+
+	for (start = pos; start < stop; start = end) {
+		au = start / s->erase;
+		end = (au + 1) * s->erase;
+		if (end > stop)
+			end = stop;
+
+		err = sim_write_au(s, au, start - au * s->erase,
+				   end - au * s->erase, &cost);
+		if (err) {
+			errno = -err;
+			return -1;
+		}
+	}
+
+	s->now += cost;
+	return ret;
+}
+
+static ssize_t sim_read(struct device *dev, void *buf, size_t size, off_t pos)
+{
+	struct sim *s = dev->priv;
+	unsigned long long first = pos, last = pos + size - 1;
+	ssize_t ret;
+
+	ret = pread(dev->fd, buf, size, pos);
+	if (ret <= 0)
+		return ret;
+
+	s->now += s->t_cmd + xfer_ns(s, size) +
+		(last / s->page - first / s->page + 1) * s->t_read +
+		(last / s->erase - first / s->erase) * s->t_cross;
+
+	return ret;
+}
+
+static int sim_discard(struct device *dev, off_t pos, size_t size)
+{
+	struct sim *s = dev->priv;
+	unsigned long long au, first, last;
+	unsigned int i;
+
+	s->now += s->t_cmd;
+	if (!size)
+		return 0;
+
+	/* only whole erase blocks get erased */
+	first = (pos + s->erase - 1) / s->erase;
+	last = (pos + size) / s->erase;
+	for (au = first; au < last; au++) {
+		for (i = 0; i < s->nr_open; i++) {
+			if (s->open[i].au == au) {
+				free(s->open[i].map);
+				memmove(&s->open[i], &s->open[i + 1],
+					(s->nr_open - i - 1) * sizeof(s->open[0]));
+				s->nr_open--;
+				break;
+			}
+		}
+		s->now += s->t_erase;
+	}
+
+	return 0;
+}
+
+static int sim_flush(struct device *dev)
+{
+	struct sim *s = dev->priv;
+
+	s->now += s->t_cmd;
+	return 0;
+}
+
+static int parse_size(const char *str, char **end, long long *val)
+{
+	errno = 0;
+	*val = strtoll(str, end, 0);
+	if (errno || *end == str || *val < 0)
+		return -EINVAL;
+
+	switch (toupper(**end)) {
+	case 'G':
+		*val *= 1024;
+		/* fall through */
+	case 'M':
+		*val *= 1024;
+		/* fall through */
+	case 'K':
+		*val *= 1024;
+		(*end)++;
+		break;
+	}
+
+	return 0;
+}
+
+static int sim_option(struct sim *s, const char *key, size_t len, long long val)
+{
+	static const struct {
+		const char *key;
+		size_t offset;
+		bool is_int;
+	} options[] = {
+		{ "erase",	offsetof(struct sim, erase),	false },
+		{ "page",	offsetof(struct sim, page),	false },
+		{ "open",	offsetof(struct sim, open_max),	true },
+		{ "fat",	offsetof(struct sim, fat),	true },
+		{ "bw",		offsetof(struct sim, bw),	false },
+		{ "cmd-ns",	offsetof(struct sim, t_cmd),	false },
+		{ "read-ns",	offsetof(struct sim, t_read),	false },
+		{ "cross-ns",	offsetof(struct sim, t_cross),	false },
+		{ "prog-ns",	offsetof(struct sim, t_prog),	false },
+		{ "copy-ns",	offsetof(struct sim, t_copy),	false },
+		{ "erase-ns",	offsetof(struct sim, t_erase),	false },
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+		if (strlen(options[i].key) != len ||
+		    strncmp(options[i].key, key, len))
+			continue;
+
+		if (options[i].is_int)
+			*(unsigned int *)((char *)s + options[i].offset) = val;
+		else
+			*(long long *)((char *)s + options[i].offset) = val;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int sim_setup(struct device *dev, const char *options)
+{
+	struct sim *s;
+	const char *p = options, *eq;
+	char *end;
+	long long val;
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	*s = sim_defaults;
+
+	while (p && *p) {
+		eq = strchr(p, '=');
+		if (!eq || parse_size(eq + 1, &end, &val) ||
+		    (*end && *end != ',') ||
+		    sim_option(s, p, eq - p, val)) {
+			fprintf(stderr, "sim: invalid option '%s'\n", p);
+			free(s);
+			return -EINVAL;
+		}
+		p = *end ? end + 1 : end;
+	}
+
+	if (!s->page || !s->erase || s->erase % s->page || !s->open_max ||
+	    !s->bw) {
+		fprintf(stderr, "sim: invalid geometry\n");
+		free(s);
+		return -EINVAL;
+	}
+
+	s->open = calloc(s->open_max, sizeof(s->open[0]));
+	if (!s->open) {
+		free(s);
+		return -ENOMEM;
+	}
+	s->nr_open = 0;
+	s->now = 0;
+
+	dev->priv = s;
+	return 0;
+}
+
+const struct dev_ops sim_ops = {
+	.name = "sim",
+	.open_flags = O_RDWR,
+	.setup = sim_setup,
+	.read = sim_read,
+	.write = sim_write,
+	.discard = sim_discard,
+	.flush = sim_flush,
+	.now = sim_now,
+};
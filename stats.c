@@ -0,0 +1,289 @@
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "stats.h"
+
+static unsigned int hist_index(long long val)
+{
+	unsigned int msb, shift;
+
+	if (val < HIST_SUB)
+		return val < 0 ? 0 : val;
+
+	msb = 63 - __builtin_clzll(val);
+	if (msb >= HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	shift = msb - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (val >> shift) - HIST_SUB;
+}
+
+long long hist_bucket_low(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < HIST_SUB)
+		return index;
+
+	shift = (index >> HIST_SUB_BITS) - 1;
+	return (long long)((index & (HIST_SUB - 1)) + HIST_SUB) << shift;
+}
+
+long long hist_bucket_high(unsigned int index)
+{
+	if (index + 1 >= HIST_BUCKETS)
+		return LLONG_MAX;
+
+	return hist_bucket_low(index + 1) - 1;
+}
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = LLONG_MAX;
+}
+
+void hist_add(struct hist *h, long long val)
+{
+	h->bucket[hist_index(val)]++;
+	h->count++;
+	h->sum += val;
+	if (val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+}
+
+void hist_merge(struct hist *h, const struct hist *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		h->bucket[i] += other->bucket[i];
+
+	h->count += other->count;
+	h->sum += other->sum;
+	if (other->min < h->min)
+		h->min = other->min;
+	if (other->max > h->max)
+		h->max = other->max;
+}
+
+long long hist_percentile(const struct hist *h, unsigned int pct)
+{
+	unsigned long long rank, seen = 0;
+	unsigned int i;
+	long long low, high;
+
+	if (!h->count)
+		return 0;
+
+	/* rank of the sample we are looking for, counting from one */
+	rank = (h->count * pct + 9999) / 10000;
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank)
+			break;
+	}
+
+	/* report the middle of the bucket, but never leave the observed range */
+	low = hist_bucket_low(i);
+	high = hist_bucket_high(i);
+	if (low < h->min)
+		low = h->min;
+	if (high > h->max)
+		high = h->max;
+
+	return low + (high - low) / 2;
+}
+
+long long hist_mean(const struct hist *h)
+{
+	if (!h->count)
+		return 0;
+
+	return h->sum / (long long)h->count;
+}
+
+struct sample_policy sample_policy = {
+	.max = 128,
+};
+
+void sampler_init(struct sampler *s, long long *buf, unsigned int max)
+{
+	s->sample = buf;
+	s->count = 0;
+	s->max = max;
+	s->total = 0;
+}
+
+long long sampler_median(const struct sampler *s)
+{
+	if (!s->count)
+		return 0;
+
+	return s->sample[s->count / 2];
+}
+
+/* 95% confidence interval of the median, as ranks counting from one */
+static bool median_interval(unsigned int n, unsigned int *lo, unsigned int *hi)
+{
+	double w = 1.96 * sqrt(n);
+
+	*lo = floor((n - w) / 2);
+	*hi = ceil(1 + (n + w) / 2);
+
+	return *lo >= 1 && *hi <= n;
+}
+
+bool sampler_add(struct sampler *s, long long val)
+{
+	unsigned int i, lo, hi;
+	long long median;
+
+	if (s->count < s->max) {
+		for (i = s->count; i > 0 && s->sample[i - 1] > val; i--)
+			s->sample[i] = s->sample[i - 1];
+		s->sample[i] = val;
+		s->count++;
+	}
+	s->total += val;
+
+	if (s->count >= s->max)
+		return true;
+	if (sample_policy.budget && s->total >= sample_policy.budget)
+		return true;
+	if (!median_interval(s->count, &lo, &hi))
+		return false;
+
+	median = sampler_median(s);
+	return (s->sample[hi - 1] - s->sample[lo - 1]) * 10000.0 <=
+		2.0 * sample_policy.target * median;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+double noise_estimate(const double *x, unsigned int n)
+{
+	double d[n > 1 ? n - 1 : 1];
+	unsigned int i;
+
+	if (n < 2)
+		return 0;
+
+	for (i = 0; i + 1 < n; i++)
+		d[i] = fabs(x[i + 1] - x[i]);
+	qsort(d, n - 1, sizeof(d[0]), cmp_double);
+
+	/*
+	 * The median absolute difference of two normal samples is
+	 * 0.6745 * sqrt(2) times their standard deviation.
+	 */
+	return d[(n - 1) / 2] / 0.9539;
+}
+
+struct segmentation {
+	const double *x;
+	double noise, threshold;
+	struct change_point *cp;
+	unsigned int nr, max;
+};
+
+static void segment(struct segmentation *s, unsigned int lo, unsigned int hi)
+{
+	double sum = 0, left = 0, best = 0, before = 0, after = 0;
+	double diff, score, cost;
+	unsigned int i, k = 0, n = hi - lo, nl, nr;
+
+	if (n < 2 || s->nr == s->max)
+		return;
+
+	for (i = lo; i < hi; i++)
+		sum += s->x[i];
+
+	/* maximizing the between-segment sum of squares */
+	for (i = lo + 1; i < hi; i++) {
+		left += s->x[i - 1];
+		nl = i - lo;
+		nr = hi - i;
+		diff = left / nl - (sum - left) / nr;
+		cost = diff * diff * nl * nr / n;
+		if (cost > best) {
+			best = cost;
+			k = i;
+			before = left / nl;
+			after = (sum - left) / nr;
+		}
+	}
+	if (!k)
+		return;
+
+	nl = k - lo;
+	nr = hi - k;
+	diff = fabs(before - after);
+	if (s->noise > 0)
+		score = diff / (s->noise * sqrt(1.0 / nl + 1.0 / nr));
+	else
+		score = HUGE_VAL;
+	if (score < s->threshold)
+		return;
+
+	s->cp[s->nr].index = k;
+	s->cp[s->nr].score = score;
+	s->cp[s->nr].before = before;
+	s->cp[s->nr].after = after;
+	s->nr++;
+
+	segment(s, lo, k);
+	segment(s, k, hi);
+}
+
+static int cmp_change_point(const void *a, const void *b)
+{
+	const struct change_point *x = a, *y = b;
+
+	return (int)x->index - (int)y->index;
+}
+
+unsigned int change_points(const double *x, unsigned int n,
+			   double noise, double threshold,
+			   struct change_point *cp, unsigned int max)
+{
+	struct segmentation s = {
+		.x = x,
+		.noise = noise > 0 ? noise : noise_estimate(x, n),
+		.threshold = threshold,
+		.cp = cp,
+		.max = max,
+	};
+
+	unsigned int i, j, lo, hi;
+	double sum;
+
+	segment(&s, 0, n);
+	qsort(cp, s.nr, sizeof(*cp), cmp_change_point);
+
+	/* the means next to each point, now that all segments are known */
+	for (i = 0; i < s.nr; i++) {
+		lo = i ? cp[i - 1].index : 0;
+		hi = i + 1 < s.nr ? cp[i + 1].index : n;
+		for (sum = 0, j = lo; j < cp[i].index; j++)
+			sum += x[j];
+		cp[i].before = sum / (cp[i].index - lo);
+		for (sum = 0, j = cp[i].index; j < hi; j++)
+			sum += x[j];
+		cp[i].after = sum / (hi - cp[i].index);
+	}
+
+	return s.nr;
+}
@@ -0,0 +1,102 @@
+#ifndef FLASHBENCH_STATS_H
+#define FLASHBENCH_STATS_H
+
+#include <stdbool.h>
+
+/*
+ * Log-bucketed latency histogram
+ *
+ * Every power of two is split into HIST_SUB linear buckets, so any
+ * recorded value is known to within 1/HIST_SUB of itself, while the
+ * memory use stays constant no matter how many samples are added.
+ * Values up to 2^HIST_MAX_BITS nanoseconds (about three days) are
+ * kept, larger ones are counted in the last bucket.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	48
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	unsigned long long count;
+	long long min, max, sum;
+	unsigned long long bucket[HIST_BUCKETS];
+};
+
+extern void hist_init(struct hist *h);
+extern void hist_add(struct hist *h, long long val);
+extern void hist_merge(struct hist *h, const struct hist *other);
+
+/* pct is given in hundredths of a percent, e.g. 9990 for p99.9 */
+extern long long hist_percentile(const struct hist *h, unsigned int pct);
+extern long long hist_mean(const struct hist *h);
+
+/* value range covered by one bucket */
+extern long long hist_bucket_low(unsigned int index);
+extern long long hist_bucket_high(unsigned int index);
+
+/*
+ * Adaptive sampling
+ *
+ * Instead of a fixed number of samples, a point can be measured
+ * until the 95% confidence interval of its median is narrower than
+ * the target, relative to the median, or until the samples add up
+ * to the time budget. The interval comes from the order statistics
+ * of the samples, so it makes no assumption about their distribution.
+ * It needs at least eight samples to be bounded at all.
+ */
+struct sample_policy {
+	unsigned int target;	/* half width in hundredths of a percent, 0 for off */
+	long long budget;	/* nanoseconds of samples per point, 0 for no limit */
+	unsigned int max;	/* samples per point */
+};
+
+extern struct sample_policy sample_policy;
+
+static inline bool sampling_adaptive(void)
+{
+	return sample_policy.target != 0;
+}
+
+struct sampler {
+	long long *sample;	/* kept in ascending order */
+	unsigned int count, max;
+	long long total;
+};
+
+extern void sampler_init(struct sampler *s, long long *buf, unsigned int max);
+
+/* returns true once the point has enough samples */
+extern bool sampler_add(struct sampler *s, long long val);
+extern long long sampler_median(const struct sampler *s);
+
+static inline long long sampler_min(const struct sampler *s)
+{
+	return s->count ? s->sample[0] : 0;
+}
+
+/*
+ * Change point detection
+ *
+ * Splits a series into segments with different means by binary
+ * segmentation: the split that separates the two means best in the
+ * least squares sense is kept if the difference is at least
+ * threshold times its standard error, and both halves are searched
+ * again. noise is the standard deviation of a single value; with
+ * zero, it is estimated from the differences between neighbours,
+ * which is robust as long as there are few steps in the series.
+ * The change points are returned in order, each giving the index
+ * of the first value of a new segment.
+ */
+struct change_point {
+	unsigned int index;
+	double score;		/* difference in units of its standard error */
+	double before, after;	/* mean of the segments on either side */
+};
+
+extern double noise_estimate(const double *x, unsigned int n);
+extern unsigned int change_points(const double *x, unsigned int n,
+				  double noise, double threshold,
+				  struct change_point *cp, unsigned int max);
+
+#endif /* FLASHBENCH_STATS_H */
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "timing.h"
+
+__thread long long timing_overhead;
+
+static inline long long time_to_ns(struct timespec *ts)
+{
+	return (long long)ts->tv_sec * 1000 * 1000 * 1000 + ts->tv_nsec;
+}
+
+/*
+ * CLOCK_MONOTONIC_RAW is not subject to NTP slewing, unlike
+ * CLOCK_REALTIME, so short intervals are never stretched or
+ * shrunk by clock adjustments.
+ */
+static long long get_ns_raw(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return time_to_ns(&ts);
+}
+
+#if defined(__x86_64__)
+/*
+ * With an invariant TSC, reading the time stamp counter is much
+ * cheaper than a clock_gettime call. The conversion to nanoseconds
+ * is a 32.32 fixed point multiplication calibrated against
+ * CLOCK_MONOTONIC_RAW at startup.
+ */
+static bool use_tsc;
+static unsigned long long tsc_base, tsc_mult;
+static long long tsc_base_ns;
+
+static inline unsigned long long read_tsc(void)
+{
+	_mm_lfence();
+	return __rdtsc();
+}
+
+static long long get_ns_tsc(void)
+{
+	unsigned long long delta = read_tsc() - tsc_base;
+
+	return tsc_base_ns + (long long)(((unsigned __int128)delta * tsc_mult) >> 32);
+}
+
+static bool tsc_invariant(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+
+	return edx & (1 << 8);
+}
+
+static void tsc_calibrate(void)
+{
+	unsigned long long t0, t1;
+	long long ns0, ns1;
+
+	if (!tsc_invariant())
+		return;
+
+	t0 = read_tsc();
+	ns0 = get_ns_raw();
+	do {
+		ns1 = get_ns_raw();
+	} while (ns1 - ns0 < 20 * 1000 * 1000);
+	t1 = read_tsc();
+
+	if (t1 <= t0)
+		return;
+
+	tsc_mult = ((unsigned __int128)(ns1 - ns0) << 32) / (t1 - t0);
+	tsc_base = t1;
+	tsc_base_ns = ns1;
+	use_tsc = true;
+}
+
+long long get_ns(void)
+{
+	if (use_tsc)
+		return get_ns_tsc();
+
+	return get_ns_raw();
+}
+
+const char *timing_source(void)
+{
+	return use_tsc ? "tsc" : "CLOCK_MONOTONIC_RAW";
+}
+#else
+static void tsc_calibrate(void)
+{
+}
+
+long long get_ns(void)
+{
+	return get_ns_raw();
+}
+
+const char *timing_source(void)
+{
+	return "CLOCK_MONOTONIC_RAW";
+}
+#endif
+
+/*
+ * Find the smallest time we can measure around a zero-length read,
+ * which is the cost of the clock itself plus entering and leaving
+ * the kernel, without any actual I/O.
+ */
+void timing_setup(int fd, void *buf)
+{
+	static pthread_once_t calibrated = PTHREAD_ONCE_INIT;
+	long long start, delta, min = LLONG_MAX;
+	int i;
+
+	/* the TSC is shared by all threads, the overhead is not */
+	pthread_once(&calibrated, tsc_calibrate);
+
+	for (i = 0; i < 1000; i++) {
+		start = get_ns();
+		if (pread(fd, buf, 0, 0) < 0)
+			break;
+		delta = get_ns() - start;
+
+		if (delta < min)
+			min = delta;
+	}
+
+	timing_overhead = (min == LLONG_MAX) ? 0 : min;
+}
@@ -0,0 +1,18 @@
+#ifndef FLASHBENCH_TIMING_H
+#define FLASHBENCH_TIMING_H
+
+/* monotonic nanoseconds, from the TSC where that is known to be stable */
+extern long long get_ns(void);
+
+/*
+ * Fixed cost of reading the clock twice around a system call that
+ * does no I/O, subtracted from every time_read/time_write/time_erase.
+ * Measured by timing_setup for the device of the calling thread.
+ */
+extern __thread long long timing_overhead;
+
+extern const char *timing_source(void);
+
+extern void timing_setup(int fd, void *buf);
+
+#endif /* FLASHBENCH_TIMING_H */
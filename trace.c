@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "dev.h"
+#include "trace.h"
+
+static struct trace_header *trace_hdr;
+static struct trace_record *trace_ring;
+static size_t trace_len;
+
+/*
+ * The file is sized and mapped up front, with its pages populated,
+ * so adding a record is only a store to memory. Writing it back is
+ * left to the kernel, or to trace_close.
+ */
+int trace_open(const char *filename, unsigned long long records)
+{
+	void *map;
+	int fd;
+
+	if (!records)
+		return -EINVAL;
+
+	trace_len = sizeof(*trace_hdr) + records * sizeof(*trace_ring);
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, trace_len)) {
+		close(fd);
+		return -errno;
+	}
+
+	map = mmap(NULL, trace_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	trace_hdr = map;
+	trace_ring = (void *)(trace_hdr + 1);
+
+	memcpy(trace_hdr->magic, TRACE_MAGIC, sizeof(trace_hdr->magic));
+	trace_hdr->record_size = sizeof(*trace_ring);
+	trace_hdr->capacity = records;
+
+	return 0;
+}
+
+void trace_close(void)
+{
+	if (!trace_hdr)
+		return;
+
+	msync(trace_hdr, trace_len, MS_SYNC);
+	munmap(trace_hdr, trace_len);
+	trace_hdr = NULL;
+	trace_ring = NULL;
+}
+
+int trace_attach(void)
+{
+	if (!trace_hdr)
+		return -1;
+
+	return __atomic_fetch_add(&trace_hdr->nr_devs, 1, __ATOMIC_RELAXED);
+}
+
+/* devices on other threads may add records at the same time */
+void trace_add(int dev, unsigned int op, unsigned long long pos,
+	       unsigned int size, long long time, long long ns)
+{
+	struct trace_record *r;
+	uint64_t i;
+
+	i = __atomic_fetch_add(&trace_hdr->head, 1, __ATOMIC_RELAXED);
+	r = &trace_ring[i % trace_hdr->capacity];
+
+	r->time = time;
+	r->ns = ns;
+	r->pos = pos;
+	r->size = size;
+	r->dev = dev;
+	r->op = op;
+	r->pad = 0;
+}
+
+/* a record with its place in the file, to keep ties in that order */
+struct sort_entry {
+	struct trace_record r;
+	unsigned int i;
+};
+
+static int cmp_time(const void *a, const void *b)
+{
+	const struct sort_entry *x = a, *y = b;
+
+	if (x->r.time != y->r.time)
+		return (x->r.time > y->r.time) - (x->r.time < y->r.time);
+
+	return (x->i > y->i) - (x->i < y->i);
+}
+
+static int sort_records(struct trace_record *recs, unsigned int nr)
+{
+	struct sort_entry *e;
+	unsigned int i;
+
+	e = malloc(nr * sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		e[i].r = recs[i];
+		e[i].i = i;
+	}
+	qsort(e, nr, sizeof(*e), cmp_time);
+	for (i = 0; i < nr; i++)
+		recs[i] = e[i].r;
+
+	free(e);
+	return 0;
+}
+
+static int add_record(struct trace_record **recs, unsigned int *nr,
+		      unsigned int *size, const struct trace_record *r)
+{
+	struct trace_record *p;
+
+	if (*nr == *size) {
+		*size = *size ? *size * 2 : 1024;
+		p = realloc(*recs, *size * sizeof(*p));
+		if (!p)
+			return -ENOMEM;
+		*recs = p;
+	}
+
+	(*recs)[(*nr)++] = *r;
+	return 0;
+}
+
+static int load_binary(FILE *f, struct trace_record **recs, unsigned int *nr)
+{
+	struct trace_header hdr;
+	struct trace_record r;
+	unsigned int size = 0;
+	uint64_t i, first;
+	int ret;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.record_size != sizeof(r) || !hdr.capacity)
+		return -EINVAL;
+
+	first = hdr.head > hdr.capacity ? hdr.head - hdr.capacity : 0;
+	for (i = first; i < hdr.head; i++) {
+		if (fseeko(f, sizeof(hdr) + (i % hdr.capacity) * sizeof(r),
+			   SEEK_SET) || fread(&r, sizeof(r), 1, f) != 1)
+			return -EINVAL;
+		if (r.dev)
+			continue;
+
+		ret = add_record(recs, nr, &size, &r);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int load_text(FILE *f, const char *filename,
+		     struct trace_record **recs, unsigned int *nr)
+{
+	struct trace_record r = { 0 };
+	unsigned long long pos, len;
+	unsigned int size = 0, lineno = 0;
+	char line[256], op[16], *p;
+	double time;
+	int ret;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		for (p = line; *p; p++)
+			if (*p == ',')
+				*p = ' ';
+		for (p = line; isspace(*p); p++)
+			;
+		if (!*p || *p == '#')
+			continue;
+
+		if (sscanf(p, "%lf %15s %llu %llu", &time, op, &pos, &len) != 4 ||
+		    time < 0 || !len || len > UINT32_MAX) {
+			fprintf(stderr, "%s:%u: need time, operation, offset and length\n",
+				filename, lineno);
+			return -EINVAL;
+		}
+
+		switch (tolower(op[0])) {
+		case 'r':
+			r.op = IO_READ;
+			break;
+		case 'w':
+			r.op = IO_WRITE;
+			break;
+		case 'd':
+		case 'e':
+			r.op = IO_ERASE;
+			break;
+		default:
+			fprintf(stderr, "%s:%u: unknown operation '%s'\n",
+				filename, lineno, op);
+			return -EINVAL;
+		}
+
+		r.time = time * 1000000000.0;
+		r.pos = pos;
+		r.size = len;
+
+		ret = add_record(recs, nr, &size, &r);
+		if (ret)
+			return ret;
+	}
+
+	return ferror(f) ? -EIO : 0;
+}
+
+/*
+ * Read a trace written by --trace, of which only the first device
+ * is used, or a text file with one request per line: the time in
+ * seconds, the operation (r for read, w for write, d or e for a
+ * discard), and the offset and length in bytes, separated by blanks
+ * or commas. Either way, the requests come back ordered by time,
+ * which starts at zero, and those at the same time in the order of
+ * the file.
+ */
+int trace_load(const char *filename, struct trace_record **recs)
+{
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	unsigned int i, nr = 0;
+	FILE *f;
+	int ret;
+
+	f = fopen(filename, "r");
+	if (!f)
+		return -errno;
+
+	*recs = NULL;
+	if (fread(magic, sizeof(magic), 1, f) == 1 &&
+	    !memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+		rewind(f);
+		ret = load_binary(f, recs, &nr);
+	} else {
+		rewind(f);
+		ret = load_text(f, filename, recs, &nr);
+	}
+	fclose(f);
+
+	if (!ret && !nr)
+		ret = -ENODATA;
+	if (!ret)
+		ret = sort_records(*recs, nr);
+	if (ret) {
+		free(*recs);
+		*recs = NULL;
+		return ret;
+	}
+
+	for (i = nr; i-- > 0; )
+		(*recs)[i].time -= (*recs)[0].time;
+
+	return nr;
+}
@@ -0,0 +1,54 @@
+#ifndef FLASHBENCH_TRACE_H
+#define FLASHBENCH_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * I/O trace
+ *
+ * With --trace, every request done by time_read, time_write,
+ * time_erase and time_queue is appended to a file that is mapped
+ * into memory, as a fixed size record. The file is a ring: once it
+ * is full, the oldest records get overwritten, and head keeps
+ * counting, so the decoder knows where the ring starts. Records are
+ * in host byte order; tracedump turns them into CSV.
+ */
+#define TRACE_MAGIC	"FBTRACE1"
+
+struct trace_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t nr_devs;	/* devices attached so far */
+	uint64_t capacity;	/* records in the ring */
+	uint64_t head;		/* records written so far */
+	uint64_t reserved[4];
+};
+
+struct trace_record {
+	int64_t time;		/* ns since the device was attached, at submission */
+	int64_t ns;		/* latency */
+	uint64_t pos;
+	uint32_t size;
+	uint16_t dev;		/* in the order the devices were attached */
+	uint8_t op;		/* enum io_dir */
+	uint8_t pad;
+};
+
+#define TRACE_DEFAULT_RECORDS	(1 << 20)
+
+extern int trace_open(const char *filename, unsigned long long records);
+extern void trace_close(void);
+
+/* a number for the device, or -1 without a trace */
+extern int trace_attach(void);
+
+/*
+ * The requests of a trace file, ordered by time, which starts at
+ * zero. Returns their number, see trace.c for the formats.
+ */
+extern int trace_load(const char *filename, struct trace_record **recs);
+
+extern void trace_add(int dev, unsigned int op, unsigned long long pos,
+		      unsigned int size, long long time, long long ns);
+
+#endif /* FLASHBENCH_TRACE_H */
@@ -0,0 +1,74 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* turn a trace written by flashbench --trace into CSV, oldest first */
+int main(int argc, char *argv[])
+{
+	static const char *op_names[] = { "read", "write", "erase" };
+	const struct trace_header *hdr;
+	const struct trace_record *rec, *r;
+	uint64_t i, first;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <trace>\n", argv[0]);
+		return EINVAL;
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[1]);
+		return errno;
+	}
+
+	if (st.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a trace\n", argv[1]);
+		return EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return errno;
+	}
+	close(fd);
+
+	hdr = map;
+	rec = (const void *)(hdr + 1);
+	if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->record_size != sizeof(*rec) ||
+	    hdr->capacity > (st.st_size - sizeof(*hdr)) / sizeof(*rec)) {
+		fprintf(stderr, "%s: not a trace, or from another version\n",
+			argv[1]);
+		return EINVAL;
+	}
+
+	/* once the ring has wrapped, the oldest record is at head */
+	first = hdr->head > hdr->capacity ? hdr->head - hdr->capacity : 0;
+
+	printf("seq,dev,time_ns,op,offset,length,latency_ns\n");
+	for (i = first; i < hdr->head; i++) {
+		r = &rec[i % hdr->capacity];
+		printf("%" PRIu64 ",%u,%" PRId64 ",%s,%" PRIu64 ",%u,%" PRId64 "\n",
+		       i, r->dev, r->time,
+		       r->op < 3 ? op_names[r->op] : "unknown",
+		       r->pos, r->size, r->ns);
+	}
+
+	munmap(map, st.st_size);
+	return 0;
+}
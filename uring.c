@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "dev.h"
+
+/*
+ * Minimal io_uring engine using the raw system calls, so we do not
+ * depend on liburing. Queued I/O is limited to plain reads and
+ * writes from the buffers that time_queue has set up, everything
+ * else goes through the synchronous system calls.
+ */
+struct uring {
+	int fd;
+	unsigned int entries;
+	unsigned int pending;	/* prepared but not yet submitted */
+	int ext_arg;		/* the kernel takes a timeout for waiting */
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags,
+			  void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, arg, argsz);
+}
+
+static void uring_free(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+}
+
+static int uring_setup_qd(struct device *dev, unsigned int entries)
+{
+	struct io_uring_params p;
+	struct uring *r = dev->priv;
+	void *sq, *cq;
+	int err;
+
+	if (r && r->entries >= entries)
+		return 0;
+
+	if (r) {
+		uring_free(r);
+		dev->priv = NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = io_uring_setup(entries, &p);
+	if (r->fd < 0) {
+		err = -errno;
+		free(r);
+		return err;
+	}
+	r->entries = p.sq_entries;
+	r->ext_arg = !!(p.features & IORING_FEAT_EXT_ARG);
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	sq = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto err;
+	r->sq_ring = sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto err;
+	}
+	r->cq_ring = cq;
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto err;
+	}
+
+	r->sq_head  = sq + p.sq_off.head;
+	r->sq_tail  = sq + p.sq_off.tail;
+	r->sq_mask  = sq + p.sq_off.ring_mask;
+	r->sq_array = sq + p.sq_off.array;
+
+	r->cq_head  = cq + p.cq_off.head;
+	r->cq_tail  = cq + p.cq_off.tail;
+	r->cq_mask  = cq + p.cq_off.ring_mask;
+	r->cqes     = cq + p.cq_off.cqes;
+
+	dev->priv = r;
+	return 0;
+
+err:
+	err = -errno;
+	uring_free(r);
+	return err;
+}
+
+static void uring_prep(struct uring *r, struct device *dev,
+		       struct io_request *req)
+{
+	unsigned int tail = *r->sq_tail;
+	unsigned int slot = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->dir == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+	sqe->addr = (unsigned long)req->buf;
+	sqe->fd = dev->fd;
+	sqe->off = req->pos % dev->size;
+	sqe->len = req->size;
+	sqe->user_data = (unsigned long)req;
+
+	r->sq_array[slot] = slot;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* only fills the submission queue, uring_complete submits it */
+static int uring_submit(struct device *dev, struct io_request *req,
+			unsigned int count)
+{
+	struct uring *r = dev->priv;
+	unsigned int i;
+
+	if (!r || r->pending + count > r->entries)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++)
+		if (req[i].dir == IO_ERASE)
+			return -EINVAL;
+
+	for (i = 0; i < count; i++)
+		uring_prep(r, dev, &req[i]);
+	r->pending += count;
+
+	return 0;
+}
+
+/*
+ * Without a timeout from the kernel, a limited wait becomes a poll,
+ * and the caller spins instead.
+ */
+static int uring_complete(struct device *dev, struct io_request **done,
+			  unsigned int max, long long wait)
+{
+	struct uring *r = dev->priv;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int head, tail, n = 0, min = 1;
+	unsigned int flags = IORING_ENTER_GETEVENTS;
+	int ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (wait == 0 || (wait > 0 && !r->ext_arg)) {
+		min = 0;
+	} else if (wait > 0) {
+		ts.tv_sec = wait / 1000000000;
+		ts.tv_nsec = wait % 1000000000;
+		arg.ts = (unsigned long)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	do {
+		ret = io_uring_enter(r->fd, r->pending, min, flags,
+				     flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+				     flags & IORING_ENTER_EXT_ARG ? sizeof(arg) : 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 && errno != ETIME) {
+		perror("io_uring_enter");
+		return -errno;
+	}
+	/* whatever the kernel did not take yet goes with the next call */
+	if (ret > 0)
+		r->pending -= ret;
+
+	/* failed requests are done as well, each CQE is consumed */
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail && n < max; head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		struct io_request *rq = (struct io_request *)(unsigned long)cqe->user_data;
+
+		rq->err = 0;
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			perror("uring_complete");
+			rq->err = cqe->res;
+		} else if ((size_t)cqe->res != rq->size) {
+			fprintf(stderr, "uring_complete: short %s at %lld\n",
+				rq->dir == IO_READ ? "read" : "write",
+				(long long)rq->pos);
+			rq->err = -EIO;
+		}
+
+		done[n++] = rq;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+const struct dev_ops uring_ops = {
+	.name = "uring",
+	.read = sync_read,
+	.write = sync_write,
+	.discard = sync_discard,
+	.flush = sync_flush,
+	.setup_qd = uring_setup_qd,
+	.submit = uring_submit,
+	.complete = uring_complete,
+};
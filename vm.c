@@ -6,8 +6,16 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "dev.h"
+#include "dist.h"
+#include "perm.h"
+#include "report.h"
+#include "stats.h"
 #include "vm.h"
 
 static inline res_t *res_ptr(res_t r)
@@ -32,24 +40,617 @@ struct syntax {
 	const char *name;
 	struct operation *(*function)(struct operation *op, struct device *dev,
 			 off_t off, off_t max, size_t len);
-	enum {
-		P_NUM = 1,
-		P_VAL = 2,
-		P_STRING = 4,
-		P_AGGREGATE = 8,
-		P_ATOM = 16,
-	} param;
+	enum param param;
 };
 
 static struct syntax syntax[];
 
 int verbose = 0;
 
+/*
+ * Result arena
+ *
+ * All result arrays, histograms and queued requests of a program
+ * come from one buffer that is sized by walking the program before
+ * it runs, so nothing gets allocated between two timed I/O
+ * operations. Memory is handed out like a stack: REDUCE and DROP
+ * give back everything their child allocated once they are done
+ * with it, and the whole arena is reset when a new program starts.
+ * Each thread has its own, to run programs on several devices.
+ */
+static __thread struct {
+	char *base;
+	size_t size;
+	size_t used;
+	unsigned int depth;
+} arena;
+
+static void *arena_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + 7) & ~(size_t)7;
+	if (arena.used + size > arena.size)
+		return NULL;
+
+	p = arena.base + arena.used;
+	arena.used += size;
+	memset(p, 0, size);
+
+	return p;
+}
+
+static inline size_t arena_mark(void)
+{
+	return arena.used;
+}
+
+static inline void arena_release(size_t mark)
+{
+	arena.used = mark;
+}
+
+/*
+ * Drop everything allocated since mark, except for the size bytes
+ * at data, which get moved down to the mark. Returns the distance
+ * the data has moved.
+ */
+static size_t arena_keep(size_t mark, void *data, size_t size)
+{
+	size_t delta = (char *)data - (arena.base + mark);
+
+	memmove(arena.base + mark, data, size);
+	arena.used = mark + ((size + 7) & ~(size_t)7);
+
+	return delta;
+}
+
+/* what running a part of the program does to the arena */
+struct shape {
+	size_t peak;		/* highest use while running */
+	size_t keep;		/* still used by the result afterwards */
+	unsigned int rows;	/* outer size of an array result */
+	unsigned int dims;	/* 0 for scalar, 1 or 2 for arrays */
+	bool result;		/* returns anything at all */
+	bool io;		/* reads, writes or erases something */
+	bool output;		/* prints something */
+	bool adaptive;		/* does a variable amount of I/O */
+};
+
+static struct operation *measure(struct operation *op, struct shape *s);
+
+static struct operation *measure_shape(struct operation *op, struct shape *s)
+{
+	struct operation *next;
+	struct shape child;
+	unsigned int i, results = 0;
+	size_t own = op->num * sizeof(res_t), kept;
+
+	memset(s, 0, sizeof(*s));
+
+	/* the offsets drawn up front, see off_skewed() */
+	if (op->code == O_OFF_ZIPF || op->code == O_OFF_HOTCOLD)
+		own += op->num * sizeof(off_t);
+
+	switch (op->code) {
+	case O_READ:
+	case O_WRITE_ZERO:
+	case O_WRITE_ONE:
+	case O_WRITE_RAND:
+	case O_ERASE:
+	case O_MIXED:
+		s->io = true;
+		/* fall through */
+	case O_LENGTH:
+	case O_OFFSET:
+		s->result = true;
+		return op+1;
+
+	case O_PRINT:
+	case O_NEWLINE:
+		s->output = true;
+		return op+1;
+
+	case O_PRINTF:
+		next = measure(op+1, s);
+		s->output = true;
+		return next;
+
+	case O_FORMAT:
+	case O_BPS:
+	case O_LEN_FIXED:
+	case O_OFF_FIXED:
+		return measure(op+1, s);
+
+	case O_DROP:
+		next = measure(op+1, &child);
+		s->peak = child.peak;
+		s->io = child.io;
+		s->output = child.output;
+		s->adaptive = child.adaptive;
+		return next;
+
+	case O_REDUCE:
+		next = measure(op+1, &child);
+		if (child.dims < 2) {
+			kept = (op->aggregate == A_HISTOGRAM) ? sizeof(struct hist) : 0;
+		} else {
+			kept = child.rows * sizeof(res_t);
+			if (op->aggregate == A_HISTOGRAM)
+				kept += child.rows * sizeof(struct hist);
+			s->rows = child.rows;
+			s->dims = 1;
+		}
+		s->peak = child.peak + kept;
+		s->keep = kept;
+		s->result = true;
+		s->io = child.io;
+		s->output = child.output;
+		s->adaptive = child.adaptive;
+		return next;
+
+	case O_SEQUENCE:
+		next = op+1;
+		kept = own;
+		for (i = 0; i < op->num && next; i++) {
+			next = measure(next, &child);
+			if (kept + child.peak > s->peak)
+				s->peak = kept + child.peak;
+			kept += child.keep;
+			s->io |= child.io;
+			s->output |= child.output;
+			s->adaptive |= child.adaptive;
+			if (child.result) {
+				results++;
+				s->rows = child.rows;
+				if (child.dims + 1 > s->dims)
+					s->dims = child.dims + 1;
+			}
+		}
+		if (!next || next->code != O_END)
+			return NULL;
+
+		/* single results get folded, see sequence() */
+		if (results != 1) {
+			s->rows = results;
+		} else {
+			s->dims--;
+		}
+		s->keep = kept;
+		s->result = true;
+		return next+1;
+
+	case O_REPEAT:
+	case O_OFF_POW2:
+	case O_OFF_LIN:
+	case O_OFF_RAND:
+	case O_OFF_ZIPF:
+	case O_OFF_HOTCOLD:
+	case O_LEN_POW2:
+	case O_MAX_POW2:
+	case O_MAX_LIN:
+		next = measure(op+1, &child);
+		s->peak = own + (op->num ? op->num - 1 : 0) * child.keep + child.peak;
+		s->keep = own + op->num * child.keep;
+		s->rows = op->num;
+		s->dims = child.dims + 1;
+		s->result = true;
+		s->io = child.io;
+		s->output = child.output;
+		s->adaptive = child.adaptive ||
+			      (op->code == O_REPEAT && sampling_adaptive());
+		return next;
+
+	default:
+		return NULL;
+	}
+}
+
+/* measure_shape, also setting op->plannable for call() to check */
+static struct operation *measure(struct operation *op, struct shape *s)
+{
+	struct operation *next = measure_shape(op, s);
+
+	if (next)
+		op->plannable = s->io && !s->output && !s->adaptive;
+
+	return next;
+}
+
+/* size the arena for a program and start over */
+static int arena_setup(struct operation *program)
+{
+	struct shape s;
+	char *p;
+
+	if (!measure(program, &s)) {
+		report_printf("malformed program\n");
+		return -EINVAL;
+	}
+
+	if (s.peak > arena.size) {
+		p = realloc(arena.base, s.peak);
+		if (!p) {
+			report_printf("out of memory\n");
+			return -ENOMEM;
+		}
+		arena.base = p;
+		arena.size = s.peak;
+	}
+	arena.used = 0;
+
+	/* the result of the last run is gone now */
+	program->result = res_null;
+	program->size_x = program->size_y = 0;
+	program->r_type = R_NONE;
+
+	return 0;
+}
+
+static struct operation *do_call(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len);
+
+/*
+ * Execution plans
+ *
+ * Any part of a program that does I/O but prints nothing is run
+ * in three steps. First the interpreter walks it without touching
+ * the device, which only records the offset, length and kind of
+ * each I/O operation in a flat list. That list is then run in a
+ * tight loop, or through time_queue with a queue depth above one.
+ * Finally the interpreter walks the same operations again and
+ * picks up the measured times in order, to build the results.
+ * The interpreter is deterministic, so both walks see the same
+ * sequence of I/O operations, and none of its overhead ends up
+ * between two timed operations.
+ */
+static __thread struct {
+	enum {
+		PLAN_OFF,
+		PLAN_COMPILE,
+		PLAN_REPLAY,
+	} mode;
+	struct io_request *req;
+	unsigned int count;
+	unsigned int size;
+	unsigned int next;
+	bool error;
+} plan;
+
+static long long plan_io(struct device *dev, enum opcode code,
+			 off_t off, size_t len)
+{
+	struct io_request *req;
+
+	if (plan.mode == PLAN_REPLAY) {
+		if (plan.next >= plan.count) {
+			plan.error = true;
+			return 0;
+		}
+		return plan.req[plan.next++].ns;
+	}
+
+	if (plan.count >= plan.size) {
+		unsigned int size = plan.size ? plan.size * 2 : 1024;
+
+		req = realloc(plan.req, size * sizeof(*req));
+		if (!req) {
+			plan.error = true;
+			return 1;
+		}
+		plan.req = req;
+		plan.size = size;
+	}
+
+	req = &plan.req[plan.count++];
+	memset(req, 0, sizeof(*req));
+	req->pos = off;
+	req->size = len;
+	switch (code) {
+	case O_READ:
+		req->dir = IO_READ;
+		break;
+	case O_ERASE:
+		req->dir = IO_ERASE;
+		break;
+	default:
+		req->dir = IO_WRITE;
+		req->which = (code == O_WRITE_ZERO) ? WBUF_ZERO :
+			     (code == O_WRITE_ONE) ? WBUF_ONE : WBUF_RAND;
+		break;
+	}
+
+	/* any nonzero time keeps BPS happy during the dry run */
+	return 1;
+}
+
+static long long do_io(struct device *dev, enum opcode code,
+		       off_t off, size_t len)
+{
+	if (plan.mode != PLAN_OFF)
+		return plan_io(dev, code, off, len);
+
+	switch (code) {
+	case O_READ:
+		return time_read(dev, off, len);
+	case O_WRITE_ZERO:
+		return time_write(dev, off, len, WBUF_ZERO);
+	case O_WRITE_ONE:
+		return time_write(dev, off, len, WBUF_ONE);
+	case O_WRITE_RAND:
+		return time_write(dev, off, len, WBUF_RAND);
+	default:
+		return time_erase(dev, off, len);
+	}
+}
+
+/* erases cannot be queued, so they split the plan into batches */
+static int plan_execute(struct device *dev)
+{
+	unsigned int i, j;
+	long long ret;
+
+	for (i = 0; i < plan.count; i = j) {
+		if (plan.req[i].dir == IO_ERASE) {
+			ret = time_erase(dev, plan.req[i].pos, plan.req[i].size);
+			if (ret < 0)
+				return ret;
+			plan.req[i].ns = ret;
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i; j < plan.count && plan.req[j].dir != IO_ERASE; j++)
+			;
+
+		ret = time_queue(dev, &plan.req[i], j - i);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+static struct operation *run_plan(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	struct operation *next;
+	size_t mark = arena_mark();
+	int ret;
+
+	pr_debug("plan %s\n", syntax[op->code].name);
+
+	plan.mode = PLAN_COMPILE;
+	plan.count = 0;
+	plan.error = false;
+	next = do_call(op, dev, off, max, len);
+	plan.mode = PLAN_OFF;
+	if (!next)
+		return NULL;
+	if (plan.error)
+		return_err("out of memory\n");
+
+	/* throw away the dry run results */
+	arena_release(mark);
+	op->result = res_null;
+	op->size_x = op->size_y = 0;
+	op->r_type = R_NONE;
+
+	ret = plan_execute(dev);
+	if (ret < 0)
+		return_err("I/O failed: %s\n", strerror(-ret));
+
+	plan.mode = PLAN_REPLAY;
+	plan.next = 0;
+	next = do_call(op, dev, off, max, len);
+	plan.mode = PLAN_OFF;
+	if (next && (plan.error || plan.next != plan.count))
+		return_err("internal error: plan replay mismatch\n");
+
+	return next;
+}
+
+/* "theta" for OFF_ZIPF, "hot:share" for OFF_HOTCOLD, "" for the default */
+static int skew_parse(struct operation *op, struct dist *d)
+{
+	char spec[64];
+
+	snprintf(spec, sizeof(spec), "%s%s%s",
+		 op->code == O_OFF_ZIPF ? "zipf" : "hotcold",
+		 *op->string ? ":" : "", op->string);
+
+	return dist_parse(d, spec);
+}
+
+static const char *param_error(struct operation *op)
+{
+	enum param param = syntax[op->code].param;
+
+	if ((param & P_NUM) && !op->num)
+		return "needs a count";
+	if (!(param & P_NUM) && op->num)
+		return "takes no count";
+	if ((param & P_VAL) && !op->val)
+		return "needs a nonzero value";
+	if (!(param & (P_VAL | P_OPTVAL)) && op->val)
+		return "takes no value";
+	if ((param & P_STRING) && !op->string)
+		return "needs a string";
+	if (!(param & P_STRING) && op->string)
+		return "takes no string";
+	if ((param & P_AGGREGATE) && !op->aggregate)
+		return "needs an aggregate";
+	if (!(param & P_AGGREGATE) && op->aggregate)
+		return "takes no aggregate";
+
+	return NULL;
+}
+
+/*
+ * Series whose step is fixed in the program must stay within off_t
+ * on their last step, for any number of steps up to .num, MIXED
+ * takes a percentage, and the skewed series need a valid skew.
+ */
+static const char *range_error(struct operation *op)
+{
+	long long val = op->val, limit;
+	struct dist d;
+
+	if (op->code == O_MIXED && (val < 0 || val > 100))
+		return "read percentage out of range";
+
+	if (!op->num)
+		return NULL;
+
+	switch (op->code) {
+	case O_OFF_ZIPF:
+	case O_OFF_HOTCOLD:
+		if (val != -1 && val <= 0)
+			return "block size out of range";
+		if (op->string && skew_parse(op, &d))
+			return "invalid skew";
+		return NULL;
+
+	case O_OFF_POW2:
+	case O_LEN_POW2:
+	case O_MAX_POW2:
+		if (op->num > 63 || val == LLONG_MIN ||
+		    llabs(val) > LLONG_MAX >> (op->num - 1))
+			return "power of two series overflows";
+		return NULL;
+
+	case O_OFF_LIN:
+	case O_OFF_RAND:
+		if (val == -1)
+			return NULL;
+		limit = op->num > 1 ? LLONG_MAX / (op->num - 1) : LLONG_MAX;
+		break;
+
+	case O_MAX_LIN:
+		if (val == -1)
+			return NULL;
+		limit = LLONG_MAX / op->num;
+		break;
+
+	default:
+		return NULL;
+	}
+
+	if (val == LLONG_MIN || llabs(val) > limit)
+		return "linear series overflows";
+
+	return NULL;
+}
+
+int vm_opcode(const char *name)
+{
+	int i;
+
+	for (i = 0; i <= O_MAX; i++)
+		if (!strcasecmp(syntax[i].name, name))
+			return syntax[i].opcode;
+
+	return -1;
+}
+
+const char *vm_opname(enum opcode code)
+{
+	return code <= O_MAX ? syntax[code].name : "(invalid)";
+}
+
+enum param vm_params(enum opcode code)
+{
+	return syntax[code].param;
+}
+
+/* number of operations in a program that passed vm_check */
+unsigned int vm_size(struct operation *program)
+{
+	struct shape s;
+
+	return measure(program, &s) - program;
+}
+
+/*
+ * Check a program of count operations before running it: every
+ * operation has the arguments that syntax[] asks for, and the
+ * operations form exactly one complete tree. program[count] must
+ * be readable and is expected to be an O_END guard.
+ */
+int vm_check(struct operation *program, unsigned int count)
+{
+	struct operation *next;
+	struct shape s;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (program[i].code > O_MAX) {
+			report_printf("operation %d: illegal command code %d\n",
+				i, program[i].code);
+			return -EINVAL;
+		}
+		if (param_error(&program[i])) {
+			report_printf("operation %d: %s %s\n", i,
+				syntax[program[i].code].name,
+				param_error(&program[i]));
+			return -EINVAL;
+		}
+		if (range_error(&program[i])) {
+			report_printf("operation %d (%s): %s\n", i,
+				syntax[program[i].code].name,
+				range_error(&program[i]));
+			return -EOVERFLOW;
+		}
+	}
+
+	next = measure(program, &s);
+	if (!next || next > program + count) {
+		report_printf("program is incomplete, missing END?\n");
+		return -EINVAL;
+	}
+	if (next < program + count) {
+		report_printf("operation %d (%s): not part of the program\n",
+			(int)(next - program), syntax[next->code].name);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* the program being run by the outermost call, to number records */
+static __thread struct operation *program;
+
+/* random numbers for MIXED */
+static __thread struct dist mix;
+
 struct operation *call(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next;
 
+	if (!arena.depth && op && arena_setup(op))
+		return NULL;
+	if (!arena.depth) {
+		program = op;
+		mix.state = perm_seed;
+	}
+
+	arena.depth++;
+	if (op && plan.mode == PLAN_OFF && op->plannable)
+		next = run_plan(op, dev, off, max, len);
+	else
+		next = do_call(op, dev, off, max, len);
+	arena.depth--;
+
+	return next;
+}
+
+static struct operation *do_call(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	struct operation *next;
+
 	if (!op)
 		return_err("internal error: NULL operation\n");
 
@@ -59,14 +660,11 @@ struct operation *call(struct operation *op, struct device *dev,
 	if (op->code > O_MAX)
 		return_err("illegal command code %d\n", op->code);
 
-	if (!(syntax[op->code].param & P_NUM) != !op->num)
-		return_err("need .num= argument\n");
-	if (!(syntax[op->code].param & P_VAL) != !op->val)
-		return_err("need .param= argument\n");
-	if (!(syntax[op->code].param & P_STRING) != !op->string)
-		return_err("need .string= argument\n");
-	if (!(syntax[op->code].param & P_AGGREGATE) != !op->aggregate)
-		return_err("need .aggregate= argument\n");
+	if (param_error(op))
+		return_err("%s %s\n", syntax[op->code].name, param_error(op));
+
+	if (range_error(op))
+		return_err("%s\n", range_error(op));
 
 	if (op->num) {
 		res_t *data;
@@ -74,9 +672,9 @@ struct operation *call(struct operation *op, struct device *dev,
 		if (res_ptr(op->result))
 			return_err("%s already has result\n", syntax[op->code].name);
 
-		data = calloc(sizeof (res_t), op->num);
+		data = arena_alloc(sizeof (res_t) * op->num);
 		if (!data)
-			return_err("out of memory");
+			return_err("result arena exhausted\n");
 
 		op->result = to_res(data, R_NONE);
 		op->r_type = R_ARRAY;
@@ -168,7 +766,7 @@ static struct operation *nop(struct operation *op, struct device *dev,
 static struct operation *do_read(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	op->result.l = time_read(dev, off, len);
+	op->result.l = do_io(dev, O_READ, off, len);
 	op->r_type = R_NS;
 	return op+1;
 }
@@ -176,7 +774,7 @@ static struct operation *do_read(struct operation *op, struct device *dev,
 static struct operation *do_write_zero(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	op->result.l = time_write(dev, off, len, WBUF_ZERO);
+	op->result.l = do_io(dev, O_WRITE_ZERO, off, len);
 	op->r_type = R_NS;
 	return op+1;
 }
@@ -184,7 +782,7 @@ static struct operation *do_write_zero(struct operation *op, struct device *dev,
 static struct operation *do_write_one(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	op->result.l = time_write(dev, off, len, WBUF_ONE);
+	op->result.l = do_io(dev, O_WRITE_ONE, off, len);
 	op->r_type = R_NS;
 	return op+1;
 }
@@ -192,7 +790,7 @@ static struct operation *do_write_one(struct operation *op, struct device *dev,
 static struct operation *do_write_rand(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	op->result.l = time_write(dev, off, len, WBUF_RAND);
+	op->result.l = do_io(dev, O_WRITE_RAND, off, len);
 	op->r_type = R_NS;
 	return op+1;
 }
@@ -200,7 +798,23 @@ static struct operation *do_write_rand(struct operation *op, struct device *dev,
 static struct operation *do_erase(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	op->result.l = time_erase(dev, off, len);
+	op->result.l = do_io(dev, O_ERASE, off, len);
+	op->r_type = R_NS;
+	return op+1;
+}
+
+/*
+ * One I/O that is a read with a probability of .val percent and a
+ * write of random data otherwise. The choices start over with every
+ * program, so each run of it does the same.
+ */
+static struct operation *do_mixed(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	enum opcode code;
+
+	code = dist_uniform(&mix) * 100 < op->val ? O_READ : O_WRITE_RAND;
+	op->result.l = do_io(dev, code, off, len);
 	op->r_type = R_NS;
 	return op+1;
 }
@@ -286,6 +900,11 @@ static struct operation *format(struct operation *op, struct device *dev,
 	struct operation *next;
 
 	next = call_propagate(op+1, dev, off, max, len, op);
+
+	/* structured output keeps the full precision values */
+	if (!report_text())
+		return next;
+
 	op->result = format_value(op->result, op->r_type, op->size_x, op->size_y);
 
 	if (op->result.s == res_null.s)
@@ -300,10 +919,22 @@ static struct operation *format(struct operation *op, struct device *dev,
 static struct operation *print_string(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	printf("%s", op->string);
+	if (report_text())
+		report_printf("%s", op->string);
 	return op+1;
 }
 
+/* nonzero buckets as "lower bound:count" pairs */
+static void print_hist(struct hist *h)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (h->bucket[i])
+			report_printf("%lld:%llu ", hist_bucket_low(i), h->bucket[i]);
+	}
+}
+
 static void *print_value(res_t val, enum resulttype type,
 			unsigned int size_x, unsigned int size_y)
 {
@@ -317,7 +948,7 @@ static void *print_value(res_t val, enum resulttype type,
 			if (!print_value(res[x], res_type(val), size_y, 0))
 				return_err("cannot print array of type %d\n",
 					res_type(val));
-			printf(size_y ? "\n" : " ");
+			report_printf(size_y ? "\n" : " ");
 		}
 
 
@@ -325,10 +956,13 @@ static void *print_value(res_t val, enum resulttype type,
 	case R_BYTE:
 	case R_NS:
 	case R_BPS:
-		printf("%lld ", val.l);
+		report_printf("%lld ", val.l);
 		break;
 	case R_STRING:
-		printf("%s ", val.s);
+		report_printf("%s ", val.s);
+		break;
+	case R_HIST:
+		print_hist((struct hist *)val._p);
 		break;
 	default:
 		return NULL;
@@ -336,15 +970,92 @@ static void *print_value(res_t val, enum resulttype type,
 	return (void *)1;
 }
 
+/*
+ * One record per value for structured output, with the position of
+ * the PRINTF in the program, the parameters it was called with and
+ * the array indices of the value.
+ */
+static void *report_value(struct operation *op, res_t val,
+			  enum resulttype type, unsigned int size_x,
+			  unsigned int size_y, int idx[2], int dim,
+			  off_t off, off_t max, size_t len)
+{
+	static const char *unit[] = {
+		[R_NS] = "ns", [R_BYTE] = "bytes", [R_BPS] = "bytes/s",
+		[R_STRING] = "string", [R_HIST] = "ns",
+	};
+	struct hist *h;
+	unsigned int x;
+	res_t *res;
+
+	if (type == R_ARRAY) {
+		if (dim == 2)
+			return NULL;
+		res = res_ptr(val);
+		for (x = 0; x < size_x; x++) {
+			idx[dim] = x;
+			if (!report_value(op, res[x], res_type(val), size_y, 0,
+					  idx, dim + 1, off, max, len))
+				return NULL;
+		}
+		idx[dim] = -1;
+		return (void *)1;
+	}
+
+	if (type != R_NS && type != R_BYTE && type != R_BPS &&
+	    type != R_STRING && type != R_HIST)
+		return NULL;
+
+	report_begin("program");
+	report_num("id", op - program);
+	report_num("off", off);
+	report_num("len", len);
+	report_num("max", max);
+	report_num("x", idx[0]);
+	report_num("y", idx[1]);
+	report_str("unit", unit[type]);
+
+	switch (type) {
+	case R_STRING:
+		report_str("value", val.s);
+		break;
+	case R_HIST:
+		h = (struct hist *)val._p;
+		report_num("value", hist_percentile(h, 5000));
+		report_num("samples", h->count);
+		report_num("min_ns", h->count ? h->min : 0);
+		report_num("mean_ns", hist_mean(h));
+		report_num("p99_ns", hist_percentile(h, 9900));
+		report_num("p99.9_ns", hist_percentile(h, 9990));
+		report_num("max_ns", h->max);
+		break;
+	default:
+		report_num("value", val.l);
+		break;
+	}
+	report_end();
+
+	return (void *)1;
+}
+
 static struct operation *print_val(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next;
+	int idx[2] = { -1, -1 };
 
 	next = call_propagate(op+1, dev, off, max, len, op);
 	if (!next)
 		return NULL;
 
+	if (!report_text()) {
+		if (!report_value(op, op->result, op->r_type, op->size_x,
+				  op->size_y, idx, 0, off, max, len))
+			return_err("cannot report value of type %d\n",
+				   op->r_type);
+		return next;
+	}
+
 	if (!print_value(op->result, op->r_type, op->size_x, op->size_y))
 		return_err("cannot print value of type %d\n", op->r_type);
 
@@ -354,7 +1065,8 @@ static struct operation *print_val(struct operation *op, struct device *dev,
 static struct operation *newline(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	printf("\n");
+	if (report_text())
+		report_printf("\n");
 	return op+1;
 }
 
@@ -362,7 +1074,7 @@ static res_t bytespersec_one(res_t res, size_t bytes, enum resulttype type,
 			unsigned int size_x, unsigned int size_y)
 {
 	if (type == R_NS)
-		res.l = 1000000000ll * bytes / res.l;
+		res.l = res.l ? 1000000000ll * bytes / res.l : 0;
 	else if (type == R_ARRAY) {
 		res_t *array = res_ptr(res);
 		type = res_type(res);
@@ -454,142 +1166,261 @@ static struct operation *len_pow2(struct operation *op, struct device *dev,
 	return next;
 }
 
-static struct operation *off_fixed(struct operation *op, struct device *dev,
+/*
+ * Step i of num in a power-of-two series: a positive val counts
+ * up from val, a negative one counts down to -val, like LEN_POW2.
+ */
+static long long pow2_step(long long val, unsigned int num, unsigned int i)
+{
+	if (val > 0)
+		return val << i;
+
+	return -val << (num - 1 - i);
+}
+
+static struct operation *off_pow2(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
-	return call_propagate(op+1, dev, off + op->val, max, len, op);
+	struct operation *next = op+1;
+	unsigned int i;
+
+	for (i = 0; i < op->num && next; i++)
+		next = call_aggregate(op+1, dev,
+				off + pow2_step(op->val, op->num, i), max, len, op);
+
+	return next;
 }
 
-static struct operation *off_lin(struct operation *op, struct device *dev,
+static struct operation *max_pow2(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next = op+1;
 	unsigned int i;
-	unsigned int num, val;
+
+	for (i = 0; i < op->num && next; i++)
+		next = call_aggregate(op+1, dev, off,
+				pow2_step(op->val, op->num, i), len, op);
+
+	return next;
+}
+
+/* a val of -1 splits the current maximum into num equal steps */
+static struct operation *max_lin(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	struct operation *next = op+1;
+	unsigned int i;
+	off_t step;
+
+	if (op->val == -1) {
+		if (max < (off_t)op->num)
+			return_err("cannot split %lld bytes into %d steps\n",
+					(long long)max, op->num);
+		step = max / op->num;
+	} else {
+		step = op->val;
+	}
+
+	for (i = 0; i < op->num && next; i++)
+		next = call_aggregate(op+1, dev, off, (i + 1) * step, len, op);
+
+	return next;
+}
+
+static struct operation *off_fixed(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	return call_propagate(op+1, dev, off + op->val, max, len, op);
+}
+
+/*
+ * Number and distance of the steps in OFF_LIN and OFF_RAND. A val
+ * of -1 fills the current maximum with chunks of the current length.
+ */
+static int series_step(struct operation *op, off_t off, off_t max,
+		       size_t len, unsigned int *num, off_t *val)
+{
+	off_t n, last;
 
 	if (op->val == -1) {
-		if (len == 0 || max < (off_t)len)
-			return_err("cannot fill %lld bytes with %ld byte chunks\n",
-					(long long)max, (long)len);
+		if (len == 0 || max < (off_t)len) {
+			report_printf("cannot fill %lld bytes with %ld byte chunks\n",
+				(long long)max, (long)len);
+			return -EINVAL;
+		}
 
-		num = max/len;
-		val = max/num;
+		n = max / len;
+		if (n > op->num) {
+			report_printf("%lld chunks of %ld bytes do not fit in %u results\n",
+				(long long)n, (long)len, op->num);
+			return -EINVAL;
+		}
+		*num = n;
+		*val = max / n;
 	} else {
-		val = op->val;
-		num = op->num;
+		*num = op->num;
+		*val = op->val;
+	}
+
+	/* the step itself was checked by range_error(), not the start */
+	if (__builtin_mul_overflow(*val, (off_t)(*num - 1), &last) ||
+	    __builtin_add_overflow(off, last, &last) ||
+	    __builtin_add_overflow(last, (off_t)len, &last)) {
+		report_printf("series from %lld in %u steps of %lld overflows\n",
+			(long long)off, *num, (long long)*val);
+		return -EOVERFLOW;
 	}
 
+	return 0;
+}
+
+static struct operation *off_lin(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	struct operation *next = op+1;
+	unsigned int i, num;
+	off_t val;
+
+	if (series_step(op, off, max, len, &num, &val))
+		return NULL;
+
 	for (i = 0; i < num && next; i++)
 		next = call_aggregate(op+1, dev, off + i * val, max, len, op);
 
 	return next;
 }
 
+static struct operation *off_rand(struct operation *op, struct device *dev,
+		 off_t off, off_t max, size_t len)
+{
+	struct operation *next = op+1;
+	unsigned int i, num;
+	off_t val;
+	struct perm perm;
+
+	if (series_step(op, off, max, len, &num, &val))
+		return NULL;
+
+	/* the same order every time, so a plan replays the same I/O */
+	perm_init(&perm, num, perm_seed);
+	for (i = 0; i < num && next; i++)
+		next = call_aggregate(op+1, dev, off + perm_map(&perm, i) * val,
+				      max, len, op);
+
+	return next;
+}
+
 /*
- * Linear feedback shift register
- *
- * We use this to randomize the block positions for random-access
- * tests. Unlike real random data, we know that within 2^bits
- * accesses, every possible value up to 2^bits will be seen
- * exactly once, with the exception of zero, for which we have
- * a special treatment.
+ * The alias table of the last skewed series, which the next one
+ * can use again if it covers the same blocks with the same skew.
  */
-static int lfsr(unsigned short v, unsigned int bits)
+static __thread struct dist skew;
+
+static int skew_setup(struct operation *op, unsigned long long n)
 {
-	unsigned short bit;
+	struct dist d;
+	int ret;
 
-	if (v >= (1 << bits)) {
-		fprintf(stderr, "lfsr: internal error\n");
-		exit(-1);
-	}
+	ret = skew_parse(op, &d);
+	if (ret)
+		return ret;
 
-	if (v == (((1 << bits) - 1) & 0xace1))
+	if (skew.n == n && skew.type == d.type && skew.theta == d.theta &&
+	    skew.hot == d.hot && skew.share == d.share) {
+		skew.state = perm_seed;
 		return 0;
-
-	if (v == 0)
-		v = ((1 << bits) - 1) & 0xace1;
-
-	switch (bits) {
-	case 8: /* x^8 + x^6 + x^5 + x^4 + 1 */
-		bit = ((v >> 0) ^ (v >> 2) ^ (v >> 3) ^ (v >> 4)) & 1;
-		break;
-	case 9: /* x9 + x5 + 1 */
-		bit = ((v >> 0) ^ (v >> 4)) & 1;
-		break;
-	case 10: /* x10 + x7 + 1 */
-		bit = ((v >> 0) ^ (v >> 3)) & 1;
-		break;
-	case 11: /* x11 + x9 + 1 */
-		bit = ((v >> 0) ^ (v >> 2)) & 1;
-		break;
-	case 12:
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 8)) & 1;
-		break;
-	case 13: /* x^13 + x^12 + x^11 + x^8 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 5)) & 1;
-		break;
-	case 14: /* x^14 + x^13 + x^12 + x^2 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ^ (v >> 2) ^ (v >> 12)) & 1;
-		break;
-	case 15: /* x^15 + x^14 + 1 */
-		bit = ((v >> 0) ^ (v >> 1) ) & 1;
-		break;
-	case 16: /* x^16 + x^14 + x^13 + x^11 + 1 */
-		bit = ((v >> 0) ^ (v >> 2) ^ (v >> 3) ^ (v >> 5) ) & 1;
-		break;
-	default:
-		fprintf(stderr, "lfsr: internal error\n");
-		exit(-1);
 	}
 
-	return v >> 1 | bit << (bits - 1);
+	dist_free(&skew);
+	skew = d;
+	ret = dist_init(&skew, n, perm_seed);
+	if (ret)
+		skew.n = 0;
+
+	return ret;
 }
 
-static struct operation *off_rand(struct operation *op, struct device *dev,
+/*
+ * OFF_ZIPF and OFF_HOTCOLD do .num accesses to the blocks of .val
+ * bytes (or the current length with -1) in the current maximum,
+ * with block 0 being the hottest. All offsets are drawn into the
+ * arena before the first access, so nothing but the I/O itself
+ * happens in the loop, and the same seed makes a plan replay the
+ * same I/O.
+ */
+static struct operation *off_skewed(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next = op+1;
+	off_t val = op->val == -1 ? (off_t)len : op->val, last;
+	unsigned long long n;
 	unsigned int i;
-	unsigned int num, val;
-	unsigned int pos = 0, bits = 0;
+	off_t *offs;
+	int ret;
 
-	if (op->val == -1) {
-		if (len == 0 || max < (off_t)len)
-			return_err("cannot fill %lld bytes with %ld byte chunks\n",
-					(long long)max, (long)len);
+	if (val <= 0 || max < val) {
+		report_printf("cannot fill %lld bytes with %lld byte blocks\n",
+			(long long)max, (long long)val);
+		return NULL;
+	}
 
-		num = max/len;
-		val = max/num;
-	} else {
-		val = op->val;
-		num = op->num;
+	n = max / val;
+	if (__builtin_mul_overflow(val, (off_t)(n - 1), &last) ||
+	    __builtin_add_overflow(off, last, &last) ||
+	    __builtin_add_overflow(last, (off_t)len, &last)) {
+		report_printf("%llu blocks of %lld bytes from %lld overflow\n",
+			n, (long long)val, (long long)off);
+		return NULL;
 	}
 
-	for (i = num; i > 0; i /= 2)
-		bits++;
+	ret = skew_setup(op, n);
+	if (ret)
+		return_err("cannot set up skew \"%s\": %s\n", op->string,
+			   strerror(-ret));
 
-	if (bits < 8)
-		bits = 8;
+	offs = arena_alloc(op->num * sizeof(*offs));
+	if (!offs)
+		return_err("result arena exhausted\n");
 
-	for (i = 0; i < num && next; i++) {
-		do {
-			pos = lfsr(pos, bits);
-		} while (pos >= num);
-		next = call_aggregate(op+1, dev, off + pos * val, max, len, op);
-	}
+	for (i = 0; i < op->num; i++)
+		offs[i] = off + (off_t)dist_next(&skew, 1) * val;
+
+	for (i = 0; i < op->num && next; i++)
+		next = call_aggregate(op+1, dev, offs[i], max, len, op);
 
 	return next;
 }
 
+/*
+ * With adaptive sampling, .num is only the upper limit and the
+ * repetition stops as soon as the median of the results is known
+ * well enough, or after the most samples the policy allows for a
+ * point. This only works for plain times, and the shorter array
+ * can only be aggregated further by REDUCE.
+ */
 static struct operation *repeat(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next = op+1;
 	unsigned int i;
+	unsigned int samples = op->num < sample_policy.max ?
+			       op->num : sample_policy.max;
+	long long buf[sampling_adaptive() ? samples : 1];
+	struct sampler sampler;
 
-	for (i = 0; i < op->num && next; i++)
+	sampler_init(&sampler, buf, samples);
+
+	for (i = 0; i < op->num && next; i++) {
 		next = call_aggregate(op+1, dev, off, max, len, op);
 
+		if (!next || !sampling_adaptive() || op->r_type != R_ARRAY ||
+		    res_type(op->result) != R_NS || !op->size_x)
+			continue;
+
+		if (sampler_add(&sampler, res_ptr(op->result)[op->size_x - 1].l))
+			break;
+	}
+
 	return next;
 }
 
@@ -620,38 +1451,142 @@ static res_t do_reduce_int(int num, res_t *input, int aggregate)
 	return result;
 }
 
+static void reduce_hist(struct hist *h, int num, res_t *input,
+			enum resulttype type)
+{
+	int i;
+
+	hist_init(h);
+	for (i = 0; i < num; i++) {
+		if (type == R_HIST)
+			hist_merge(h, (struct hist *)input[i]._p);
+		else
+			hist_add(h, input[i].l);
+	}
+}
+
+static res_t do_reduce(int num, res_t *input, enum resulttype type,
+			struct operation *op)
+{
+	res_t result = res_null;
+	struct hist tmp, *h;
+
+	switch (op->aggregate) {
+	case A_PERCENTILE:
+		reduce_hist(&tmp, num, input, type);
+		result.l = hist_percentile(&tmp, op->val ? op->val : 5000);
+		return result;
+
+	case A_HISTOGRAM:
+		h = arena_alloc(sizeof(*h));
+		if (h)
+			reduce_hist(h, num, input, type);
+		result._p = (res_t *)h;
+		return result;
+
+	default:
+		return do_reduce_int(num, input, op->aggregate);
+	}
+}
+
+static bool reduce_check(enum resulttype type, int aggregate)
+{
+	switch (type) {
+	case R_NS:
+		return true;
+	case R_BPS:
+		return aggregate != A_HISTOGRAM;
+	case R_HIST:
+		return aggregate == A_HISTOGRAM || aggregate == A_PERCENTILE;
+	default:
+		return false;
+	}
+}
+
+static enum resulttype reduce_type(enum resulttype type, int aggregate)
+{
+	if (aggregate == A_HISTOGRAM)
+		return R_HIST;
+	if (type == R_HIST)
+		return R_NS;
+	return type;
+}
+
+/*
+ * Only the reduced result stays in the arena, everything the child
+ * allocated is given back.
+ */
+static void reduce_keep(struct operation *op, size_t mark)
+{
+	unsigned int i;
+	size_t delta;
+	res_t *out;
+
+	switch (op->r_type) {
+	case R_HIST:
+		delta = arena_keep(mark, op->result._p, sizeof(struct hist));
+		op->result._p = (res_t *)((char *)op->result._p - delta);
+		break;
+
+	case R_ARRAY:
+		out = res_ptr(op->result);
+		delta = arena_keep(mark, out, arena.base + arena.used - (char *)out);
+		out = (res_t *)((char *)out - delta);
+		if (res_type(op->result) == R_HIST) {
+			for (i = 0; i < op->size_x; i++)
+				out[i]._p = (res_t *)((char *)out[i]._p - delta);
+		}
+		op->result = to_res(out, res_type(op->result));
+		break;
+
+	default:
+		arena_release(mark);
+		break;
+	}
+}
+
 static struct operation *reduce(struct operation *op, struct device *dev,
 		 off_t off, off_t max, size_t len)
 {
 	struct operation *next, *child;
 	unsigned int i;
 	enum resulttype type;
-	res_t *in;
+	size_t mark = arena_mark();
+	res_t *in, *out;
 
 	child = op+1;
 	next = call(child, dev, off, max, len);
 	if (!next)
 		return NULL;
 
+	/* single histogram */
+	if (child->r_type == R_HIST) {
+		if (!reduce_check(R_HIST, op->aggregate))
+			return_err("cannot reduce histogram this way\n");
+
+		op->result = do_reduce(1, &child->result, R_HIST, op);
+		op->size_x = op->size_y = 0;
+		op->r_type = reduce_type(R_HIST, op->aggregate);
+		goto clear_child;
+	}
+
 	/* single value */
 	if (child->r_type != R_ARRAY || child->size_x == 0)
 		return_err("cannot reduce scalar further, type %d, size %d\n",
 				child->r_type, child->size_y);
 
-	/* data does not fit */
-	if (child->size_y > op->num)
-		return_err("target array too short\n"); /* FIXME: is this necessary? */
-
 	/* one-dimensional array */
 	if (child->size_y == 0) {
-		if (res_type(child->result) != R_NS &&
-		    res_type(child->result) != R_BPS)
-			return_err("cannot reduce type %d\n", res_type(child->result));
-
-		op->result = do_reduce_int(child->size_x, res_ptr(child->result),
-					op->aggregate);
+		type = res_type(child->result);
+		if (!reduce_check(type, op->aggregate))
+			return_err("cannot reduce type %d\n", type);
+
+		op->result = do_reduce(child->size_x, res_ptr(child->result),
+					type, op);
+		if (op->aggregate == A_HISTOGRAM && !op->result._p)
+			return_err("result arena exhausted\n");
 		op->size_x = op->size_y = 0;
-		op->r_type = res_type(child->result);
+		op->r_type = reduce_type(type, op->aggregate);
 		goto clear_child;
 	}
 
@@ -661,20 +1596,30 @@ static struct operation *reduce(struct operation *op, struct device *dev,
 		return_err("inconsistent array contents\n");
 
 	type = res_type(in[0]);
+	if (!reduce_check(type, op->aggregate))
+		return_err("cannot reduce type %d\n", type);
+
+	out = arena_alloc(child->size_x * sizeof(res_t));
+	if (!out)
+		return_err("result arena exhausted\n");
+
 	for (i=0; i<child->size_x; i++) {
 		if (res_type(in[i]) != type)
 			return_err("cannot combine type %d and %d\n",
 				 res_type(in[i]), type);
 
-		res_ptr(op->result)[i] = do_reduce_int(child->size_y, res_ptr(in[i]),
-						   op->aggregate);
+		out[i] = do_reduce(child->size_y, res_ptr(in[i]), type, op);
+		if (op->aggregate == A_HISTOGRAM && !out[i]._p)
+			return_err("result arena exhausted\n");
 	}
-	op->result = to_res(res_ptr(op->result), type);
-	op->size_x = child->size_y;
+	op->result = to_res(out, reduce_type(type, op->aggregate));
+	op->size_x = child->size_x;
 	op->size_y = 0;
 	op->r_type = R_ARRAY;
 
 clear_child:
+	reduce_keep(op, mark);
+
 	child->result = res_null;
 	child->size_x = child->size_y = 0;
 	child->r_type = R_NONE;
@@ -687,11 +1632,14 @@ static struct operation *drop(struct operation *op, struct device *dev,
 {
 	struct operation *next, *child;
 
+	size_t mark = arena_mark();
+
 	child = op+1;
 	next = call(child, dev, off, max, len);
 	if (!next)
 		return NULL;
 
+	arena_release(mark);
 	child->result = res_null;
 	child->r_type = R_NONE;
 	child->size_x = child->size_y = 0;
@@ -706,6 +1654,7 @@ static struct syntax syntax[] = {
 	{ O_WRITE_ONE,	"WRITE_ONE",	do_write_one,	},
 	{ O_WRITE_RAND,	"WRITE_RAND",	do_write_rand,	},
 	{ O_ERASE,	"ERASE",	do_erase,	},
+	{ O_MIXED,	"MIXED",	do_mixed,	P_OPTVAL },
 	{ O_LENGTH,	"LENGTH",	length_or_offs	},
 	{ O_OFFSET,	"OFFSET",	length_or_offs,	},
 
@@ -719,15 +1668,17 @@ static struct syntax syntax[] = {
 	{ O_REPEAT,	"REPEAT",	repeat,		P_NUM },
 
 	{ O_OFF_FIXED,	"OFF_FIXED",	off_fixed,	P_VAL },
-	{ O_OFF_POW2,	"OFF_POW2",	nop,		P_NUM | P_VAL },
+	{ O_OFF_POW2,	"OFF_POW2",	off_pow2,	P_NUM | P_VAL },
 	{ O_OFF_LIN,	"OFF_LIN",	off_lin,	P_NUM | P_VAL },
 	{ O_OFF_RAND,	"OFF_RAND",	off_rand,	P_NUM | P_VAL },
+	{ O_OFF_ZIPF,	"OFF_ZIPF",	off_skewed,	P_NUM | P_VAL | P_STRING },
+	{ O_OFF_HOTCOLD, "OFF_HOTCOLD",	off_skewed,	P_NUM | P_VAL | P_STRING },
 	{ O_LEN_FIXED,	"LEN_FIXED",	len_fixed,	P_VAL },
 	{ O_LEN_POW2,	"LEN_POW2",	len_pow2,	P_NUM | P_VAL },
-	{ O_MAX_POW2,	"MAX_POW2",	nop,		P_NUM | P_VAL },
-	{ O_MAX_LIN,	"MAX_LIN",	nop,		P_NUM | P_VAL },
+	{ O_MAX_POW2,	"MAX_POW2",	max_pow2,	P_NUM | P_VAL },
+	{ O_MAX_LIN,	"MAX_LIN",	max_lin,	P_NUM | P_VAL },
 
-	{ O_REDUCE,	"REDUCE",	reduce,		P_AGGREGATE },
+	{ O_REDUCE,	"REDUCE",	reduce,		P_AGGREGATE | P_OPTVAL },
 	{ O_DROP,	"DROP",		drop,		},
 };
 
@@ -2,6 +2,9 @@
 #define FLASHBENCH_VM_H
 
 #include <sys/types.h>
+#include <stdbool.h>
+
+#include "report.h"
 
 typedef union result res_t;
 
@@ -12,6 +15,7 @@ enum resulttype {
 	R_BYTE,
 	R_BPS,
 	R_STRING,
+	R_HIST,
 };
 
 union result {
@@ -22,6 +26,16 @@ union result {
 
 struct device;
 
+/* arguments taken by each opcode */
+enum param {
+	P_NUM = 1,
+	P_VAL = 2,
+	P_STRING = 4,
+	P_AGGREGATE = 8,
+	P_ATOM = 16,
+	P_OPTVAL = 32,
+};
+
 struct operation {
 	enum opcode {
 		/* end of program marker */
@@ -33,6 +47,7 @@ struct operation {
 		O_WRITE_ONE,
 		O_WRITE_RAND,
 		O_ERASE,
+		O_MIXED,
 		O_LENGTH,
 		O_OFFSET,
 
@@ -52,6 +67,8 @@ struct operation {
 		O_OFF_POW2,
 		O_OFF_LIN,
 		O_OFF_RAND,
+		O_OFF_ZIPF,
+		O_OFF_HOTCOLD,
 		O_LEN_FIXED,
 		O_LEN_POW2,
 		O_MAX_POW2,
@@ -73,7 +90,7 @@ struct operation {
 	/* command code specific value */
 	long long val;
 
-	/* output string for O_PRINT */
+	/* output string for O_PRINT, skew for O_OFF_ZIPF and O_OFF_HOTCOLD */
 	const char *string;
 
 	/* aggregation of results from children */
@@ -84,8 +101,13 @@ struct operation {
 		A_AVERAGE,
 		A_TOTAL,
 		A_IGNORE,
+		A_PERCENTILE,	/* .val in hundredths of a percent, default median */
+		A_HISTOGRAM,
 	} aggregate;
 
+	/* the subtree can run as a plan, set by the interpreter */
+	bool plannable;
+
 	/* dynamic result contents */
 	res_t		result;
 	unsigned int	size_x;
@@ -96,8 +118,18 @@ struct operation {
 extern struct operation *call(struct operation *program, struct device *dev,
 		 off_t off, off_t max, size_t len);
 
+extern int vm_opcode(const char *name);
+extern const char *vm_opname(enum opcode code);
+extern enum param vm_params(enum opcode code);
+extern int vm_check(struct operation *program, unsigned int count);
+extern unsigned int vm_size(struct operation *program);
+
+/* read a program in text form, see README, and free it with its strings */
+extern struct operation *load_program(const char *filename);
+extern void free_program(struct operation *program);
+
 extern int verbose;
-#define pr_debug(...) do { if (verbose) printf(__VA_ARGS__); } while(0)
-#define return_err(...) do { printf(__VA_ARGS__); return NULL; } while(0)
+#define pr_debug(...) do { if (verbose) report_printf(__VA_ARGS__); } while(0)
+#define return_err(...) do { report_printf(__VA_ARGS__); return NULL; } while(0)
 
 #endif /* FLASHBENCH_VM_H */